@@ -0,0 +1,338 @@
+/*
+ * anim.c
+ *
+ * Packed stroke storage for animations
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "anim.h"
+#include "raster.h"
+
+/* Make room for one more element of SIZE bytes in *ARRAY */
+static int grow(void *array, uint32_t nr, uint32_t *max, size_t size)
+{
+	void **p = array;
+	uint32_t n;
+	void *q;
+
+	if (nr < *max)
+		return 0;
+	n = *max ? *max * 2 : 256;
+	q = realloc(*p, n * size);
+	if (q == NULL)
+		return -1;
+	*p = q;
+	*max = n;
+	return 0;
+}
+
+void anim_init(struct anim *a)
+{
+	memset(a, 0, sizeof(*a));
+}
+
+void anim_free(struct anim *a)
+{
+	free(a->points);
+	free(a->strokes);
+	free(a->frames);
+	anim_init(a);
+}
+
+int anim_begin_stroke(struct anim *a)
+{
+	if (a->stroke_open)
+		anim_end_stroke(a);
+	if (grow(&a->strokes, a->nr_strokes, &a->max_strokes, sizeof(*a->strokes)) < 0)
+		return -1;
+	a->strokes [a->nr_strokes].first = a->nr_points;
+	a->strokes [a->nr_strokes].count = 0;
+	a->nr_strokes++;
+	a->stroke_open = 1;
+	return 0;
+}
+
+int anim_add_point(struct anim *a, int x, int y)
+{
+	if (!a->stroke_open && anim_begin_stroke(a) < 0)
+		return -1;
+	if (grow(&a->points, a->nr_points, &a->max_points, sizeof(*a->points)) < 0)
+		return -1;
+	a->points [a->nr_points].x = x;
+	a->points [a->nr_points].y = y;
+	a->nr_points++;
+	a->strokes [a->nr_strokes - 1].count++;
+	return 0;
+}
+
+void anim_end_stroke(struct anim *a)
+{
+	struct anim_range *s;
+
+	if (!a->stroke_open)
+		return;
+	a->stroke_open = 0;
+
+	/* a tap without any movement is not recorded */
+	s = &a->strokes [a->nr_strokes - 1];
+	if (s->count < 2) {
+		a->nr_points = s->first;
+		a->nr_strokes--;
+	}
+}
+
+int anim_commit(struct anim *a)
+{
+	struct anim_range cur;
+
+	anim_end_stroke(a);
+	if (grow(&a->frames, a->nr_frames - a->base, &a->max_frames,
+		 sizeof(*a->frames)) < 0)
+		return -1;
+	cur = anim_current(a);
+	a->frames [a->nr_frames++ - a->base] = cur;
+	return 0;
+}
+
+void anim_discard(struct anim *a)
+{
+	struct anim_range cur = anim_current(a);
+
+	a->stroke_open = 0;
+	if (cur.count)
+		a->nr_points = a->strokes [cur.first].first;
+	a->nr_strokes = cur.first;
+}
+
+void anim_drop(struct anim *a, uint32_t n)
+{
+	uint32_t i, s, p;
+
+	if (n > a->nr_frames - a->base)
+		n = a->nr_frames - a->base;
+	if (n == 0)
+		return;
+
+	/* the arrays start with the oldest frame held, so everything
+	   before the end of the last one dropped goes */
+	s = a->frames [n - 1].first + a->frames [n - 1].count;
+	p = s < a->nr_strokes ? a->strokes [s].first : a->nr_points;
+
+	memmove(a->points, a->points + p, (a->nr_points - p) * sizeof(*a->points));
+	a->nr_points -= p;
+	memmove(a->strokes, a->strokes + s, (a->nr_strokes - s) * sizeof(*a->strokes));
+	a->nr_strokes -= s;
+	for (i = 0; i < a->nr_strokes; i++)
+		a->strokes [i].first -= p;
+	memmove(a->frames, a->frames + n,
+		(a->nr_frames - a->base - n) * sizeof(*a->frames));
+	a->base += n;
+	for (i = 0; i < a->nr_frames - a->base; i++)
+		a->frames [i].first -= s;
+}
+
+void anim_draw_frame(const struct anim *a, uint32_t frame,
+		     unsigned fg, unsigned bg)
+{
+	const struct anim_range *f;
+	uint32_t i;
+
+	fillrect(0, 0, xres - 1, yres - 1, bg);
+	if ((a = anim_frame(a, frame, &frame)) == NULL)
+		return;
+	f = anim_frame_range(a, frame);
+	for (i = f->first; i < f->first + f->count; i++)
+		polyline(anim_stroke_points(a, i), a->strokes [i].count, fg, NULL);
+}
+
+/* A stroke of one of the two frames, keyed by a hash of its points */
+struct delta_key {
+	uint32_t hash;
+	uint32_t stroke;
+	int matched;
+};
+
+static uint32_t stroke_hash(const struct anim *a, uint32_t stroke)
+{
+	const unsigned char *p = (const unsigned char *)anim_stroke_points(a, stroke);
+	size_t i, n = a->strokes [stroke].count * sizeof(struct point);
+	uint32_t h = 2166136261u;
+
+	for (i = 0; i < n; i++)
+		h = (h ^ p [i]) * 16777619u;
+	return h;
+}
+
+static int key_cmp(const void *x, const void *y)
+{
+	const struct delta_key *a = x, *b = y;
+
+	return a->hash < b->hash ? -1 : a->hash > b->hash;
+}
+
+static int same_stroke(const struct anim *a, uint32_t s, uint32_t t)
+{
+	return a->strokes [s].count == a->strokes [t].count &&
+		memcmp(anim_stroke_points(a, s), anim_stroke_points(a, t),
+		       a->strokes [s].count * sizeof(struct point)) == 0;
+}
+
+static struct delta_key *frame_keys(const struct anim *a, uint32_t frame)
+{
+	const struct anim_range *f = anim_frame_range(a, frame);
+	struct delta_key *k;
+	uint32_t i;
+
+	k = malloc((f->count ? f->count : 1) * sizeof(*k));
+	if (k == NULL)
+		return NULL;
+	for (i = 0; i < f->count; i++) {
+		k [i].hash = stroke_hash(a, f->first + i);
+		k [i].stroke = f->first + i;
+		k [i].matched = 0;
+	}
+	qsort(k, f->count, sizeof(*k), key_cmp);
+	return k;
+}
+
+static void stroke_box(const struct anim *a, uint32_t stroke, struct fb_rect *r)
+{
+	const struct point *p = anim_stroke_points(a, stroke);
+	uint32_t i, n = a->strokes [stroke].count;
+	int x1 = p [0].x, y1 = p [0].y, x2 = x1, y2 = y1;
+
+	for (i = 1; i < n; i++) {
+		if (p [i].x < x1) x1 = p [i].x;
+		if (p [i].x > x2) x2 = p [i].x;
+		if (p [i].y < y1) y1 = p [i].y;
+		if (p [i].y > y2) y2 = p [i].y;
+	}
+	r->x = x1;
+	r->y = y1;
+	r->w = x2 - x1 + 1;
+	r->h = y2 - y1 + 1;
+}
+
+static int overlaps(const struct fb_rect *a, const struct fb_rect *b)
+{
+	return a->x < b->x + b->w && b->x < a->x + a->w &&
+		a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+/* Erase BOX and redraw the strokes of frame TO that cross it */
+static void redraw_box(const struct anim *a, uint32_t to,
+		       const struct fb_rect *box, unsigned fg, unsigned bg)
+{
+	const struct anim_range *f = anim_frame_range(a, to);
+	struct fb_rect r;
+	uint32_t i;
+
+	set_clip(box);
+	fillrect(box->x, box->y, box->x + box->w - 1, box->y + box->h - 1, bg);
+	for (i = f->first; i < f->first + f->count; i++) {
+		stroke_box(a, i, &r);
+		if (overlaps(&r, box))
+			polyline(anim_stroke_points(a, i), a->strokes [i].count,
+				 fg, NULL);
+	}
+	set_clip(NULL);
+}
+
+int anim_draw_delta(const struct anim *a, uint32_t from, uint32_t to,
+		    unsigned fg, unsigned bg)
+{
+	const struct anim *fa, *ta;
+	const struct anim_range *ff, *ft;
+	struct delta_key *kf, *kt;
+	struct fb_rect box;
+	uint32_t i, j, k, local;
+
+	/* FROM first: fetching TO keeps the frame used last.  It may still
+	 * have moved to make room, so FROM is looked up again. */
+	anim_frame(a, from, &local);
+	ta = anim_frame(a, to, &to);
+	if (ta == NULL)
+		return 0;
+	fa = anim_frame(a, from, &from);
+	if (fa != ta) {
+		/* one of them was dropped, the other not: no common strokes */
+		anim_draw_frame(ta, to, fg, bg);
+		return 0;
+	}
+	a = ta;
+	ff = anim_frame_range(a, from);
+	ft = anim_frame_range(a, to);
+
+	kf = frame_keys(a, from);
+	kt = frame_keys(a, to);
+	if (kf == NULL || kt == NULL) {
+		free(kf);
+		free(kt);
+		anim_draw_frame(a, to, fg, bg);
+		return -1;
+	}
+
+	/* Pair up identical strokes; both lists are sorted by hash */
+	for (i = j = 0; i < ff->count && j < ft->count; ) {
+		if (kf [i].hash < kt [j].hash) {
+			i++;
+		} else if (kf [i].hash > kt [j].hash) {
+			j++;
+		} else {
+			for (k = j; k < ft->count && kt [k].hash == kf [i].hash; k++)
+				if (!kt [k].matched &&
+				    same_stroke(a, kf [i].stroke, kt [k].stroke)) {
+					kf [i].matched = kt [k].matched = 1;
+					break;
+				}
+			i++;
+		}
+	}
+
+	/* Whatever is left appears or disappears */
+	for (i = 0; i < ff->count; i++)
+		if (!kf [i].matched) {
+			stroke_box(a, kf [i].stroke, &box);
+			redraw_box(a, to, &box, fg, bg);
+		}
+	for (j = 0; j < ft->count; j++)
+		if (!kt [j].matched) {
+			stroke_box(a, kt [j].stroke, &box);
+			redraw_box(a, to, &box, fg, bg);
+		}
+
+	free(kf);
+	free(kt);
+	return 0;
+}
+
+void anim_raster_stroke(unsigned char **rows, int w, int h,
+			const struct point *p, uint32_t n)
+{
+	const struct raster_ops *ops = raster_select(8, 0);
+	struct raster_line l;
+	uint32_t i;
+
+	if (n == 1 && raster_clip_line(p [0].x, p [0].y, p [0].x, p [0].y,
+				       w, h, 0, &l))
+		ops->line(rows, &l, 1);
+	for (i = 1; i < n; i++)
+		if (raster_clip_line(p [i - 1].x, p [i - 1].y, p [i].x, p [i].y,
+				     w, h, i > 1, &l))
+			ops->line(rows, &l, 1);
+}
+
+size_t anim_bytes(const struct anim *a)
+{
+	return a->max_points * sizeof(*a->points) +
+		a->max_strokes * sizeof(*a->strokes) +
+		a->max_frames * sizeof(*a->frames);
+}
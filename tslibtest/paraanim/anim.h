@@ -0,0 +1,142 @@
+/*
+ * anim.h
+ *
+ * Packed stroke storage for animations
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _ANIM_H
+#define _ANIM_H
+
+#include <stdint.h>
+
+#include "fbutils.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A run of consecutive entries in one of the arrays below */
+struct anim_range {
+	uint32_t first, count;
+};
+
+/* All points of all frames live in one array, a stroke is a range of
+ * points and a frame a range of strokes.  The strokes after the last
+ * frame form the drawing in progress; committing it as a frame only
+ * appends a range, nothing is copied.
+ *
+ * The oldest frames may be dropped from the arrays (see anim_drop()),
+ * e.g. once they are kept elsewhere.  Frame numbers stay the same:
+ * frames [0] is frame BASE, and frames below BASE can only be reached
+ * through anim_frame(), which asks FAULT for them.
+ */
+struct anim {
+	struct point *points;
+	struct anim_range *strokes;
+	struct anim_range *frames;
+	uint32_t nr_points, nr_strokes, nr_frames;
+	uint32_t max_points, max_strokes, max_frames;
+	uint32_t base;			/* first frame held in the arrays */
+	int stroke_open;		/* the last stroke is still growing */
+
+	/* Returns an animation holding FRAME (< base) and its number
+	 * there in *LOCAL, or NULL.  The result may only be valid until
+	 * the next call. */
+	const struct anim *(*fault)(const struct anim *a, uint32_t frame,
+				    uint32_t *local);
+};
+
+void anim_init(struct anim *a);
+void anim_free(struct anim *a);
+
+/* Start a stroke in the drawing in progress and add points to it.
+ * Return -1 if memory runs out. */
+int anim_begin_stroke(struct anim *a);
+int anim_add_point(struct anim *a, int x, int y);
+/* Close the open stroke, dropping it if it has fewer than two points */
+void anim_end_stroke(struct anim *a);
+
+/* Turn the drawing in progress into the next frame */
+int anim_commit(struct anim *a);
+/* Throw away the drawing in progress */
+void anim_discard(struct anim *a);
+
+/* Drop the N oldest frames held in the arrays, and their strokes */
+void anim_drop(struct anim *a, uint32_t n);
+
+/* Strokes of the drawing in progress */
+static inline struct anim_range anim_current(const struct anim *a)
+{
+	const struct anim_range *last;
+	struct anim_range r;
+
+	r.first = 0;
+	if (a->nr_frames > a->base) {
+		last = &a->frames [a->nr_frames - a->base - 1];
+		r.first = last->first + last->count;
+	}
+	r.count = a->nr_strokes - r.first;
+	return r;
+}
+
+/* Strokes of FRAME, which must be held in the arrays */
+static inline const struct anim_range *anim_frame_range(const struct anim *a,
+							 uint32_t frame)
+{
+	return &a->frames [frame - a->base];
+}
+
+/* The animation holding FRAME, A itself unless the frame was dropped,
+ * and the frame's number there in *LOCAL.  NULL if it cannot be had.
+ */
+static inline const struct anim *anim_frame(const struct anim *a,
+					    uint32_t frame, uint32_t *local)
+{
+	if (frame >= a->base) {
+		*local = frame;
+		return a;
+	}
+	return a->fault ? a->fault(a, frame, local) : NULL;
+}
+
+static inline const struct point *anim_stroke_points(const struct anim *a,
+						     uint32_t stroke)
+{
+	return a->points + a->strokes [stroke].first;
+}
+
+/* Draw FRAME on a screen cleared to BG, strokes in FG */
+void anim_draw_frame(const struct anim *a, uint32_t frame,
+		     unsigned fg, unsigned bg);
+
+/* Turn the screen from showing frame FROM into showing frame TO,
+ * touching only what differs: strokes present in both are left alone,
+ * and the bounding box of every other stroke of either frame is erased
+ * and redrawn, clipped to itself.  The damage recorded is no larger
+ * than those boxes.  Returns -1 if memory runs out, after drawing TO in
+ * full instead.
+ */
+int anim_draw_delta(const struct anim *a, uint32_t from, uint32_t to,
+		    unsigned fg, unsigned bg);
+
+/* Plot the stroke through N points into ROWS, an off-screen W x H
+ * raster of one byte per pixel, setting its pixels to 1.  The pixels are
+ * exactly those polyline() would draw.
+ */
+void anim_raster_stroke(unsigned char **rows, int w, int h,
+			const struct point *p, uint32_t n);
+
+/* Bytes held by A */
+size_t anim_bytes(const struct anim *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ANIM_H */
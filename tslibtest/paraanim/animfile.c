@@ -0,0 +1,443 @@
+/*
+ * animfile.c
+ *
+ * Compact on-disk animations, mapped and decoded frame by frame
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "animfile.h"
+
+#define HEADER_SIZE	24
+#define INDEX_SIZE	24
+
+struct animfile {
+	const unsigned char *base;
+	size_t length;
+	uint32_t nr_frames;
+	const unsigned char *index;
+	const unsigned char *data;
+	uint32_t data_length;
+};
+
+/* Growable byte buffer for writing */
+struct buf {
+	unsigned char *p;
+	size_t len, size;
+	int failed;
+};
+
+static void put(struct buf *b, const void *p, size_t n)
+{
+	unsigned char *q;
+	size_t size;
+
+	if (b->failed)
+		return;
+	if (b->len + n > b->size) {
+		size = b->size ? b->size * 2 : 4096;
+		while (size < b->len + n)
+			size *= 2;
+		q = realloc(b->p, size);
+		if (q == NULL) {
+			b->failed = 1;
+			return;
+		}
+		b->p = q;
+		b->size = size;
+	}
+	memcpy(b->p + b->len, p, n);
+	b->len += n;
+}
+
+static void put32(struct buf *b, uint32_t v)
+{
+	unsigned char p [4] = { v, v >> 8, v >> 16, v >> 24 };
+
+	put(b, p, 4);
+}
+
+static void put16(struct buf *b, int v)
+{
+	unsigned char p [2] = { v, v >> 8 };
+
+	put(b, p, 2);
+}
+
+static void put_varint(struct buf *b, uint32_t v)
+{
+	unsigned char p [5];
+	int n = 0;
+
+	while (v >= 0x80) {
+		p [n++] = v | 0x80;
+		v >>= 7;
+	}
+	p [n++] = v;
+	put(b, p, n);
+}
+
+/* Small differences of either sign become small varints */
+static void put_svarint(struct buf *b, int v)
+{
+	put_varint(b, v < 0 ? ((uint32_t)~v << 1) | 1 : (uint32_t)v << 1);
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return p [0] | p [1] << 8 | p [2] << 16 | (uint32_t)p [3] << 24;
+}
+
+static int get16(const unsigned char *p)
+{
+	return (int16_t)(p [0] | p [1] << 8);
+}
+
+/* Returns 0 past END or on an overlong varint */
+static int get_varint(const unsigned char **pp, const unsigned char *end,
+		      uint32_t *v)
+{
+	const unsigned char *p = *pp;
+	uint32_t x = 0;
+	int shift;
+
+	for (shift = 0; p < end && shift < 35; shift += 7) {
+		x |= (uint32_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*v = x;
+			*pp = p;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static uint32_t hash_bytes(const unsigned char *p, size_t n)
+{
+	uint32_t h = 2166136261u;
+
+	while (n--)
+		h = (h ^ *p++) * 16777619u;
+	return h;
+}
+
+/* Append the data of FRAME to B; the bounding box goes to R */
+static uint32_t encode_frame(struct buf *b, const struct anim *a,
+			     uint32_t frame, int *r)
+{
+	const struct anim_range *f = anim_frame_range(a, frame);
+	const struct point *p;
+	uint32_t s, i, n = 0;
+	int x = 0, y = 0;
+
+	r [0] = r [1] = 32767;
+	r [2] = r [3] = -32768;
+	put_varint(b, f->count);
+	for (s = f->first; s < f->first + f->count; s++) {
+		p = anim_stroke_points(a, s);
+		put_varint(b, a->strokes [s].count);
+		for (i = 0; i < a->strokes [s].count; i++) {
+			put_svarint(b, p [i].x - x);
+			put_svarint(b, p [i].y - y);
+			x = p [i].x;
+			y = p [i].y;
+			if (x < r [0]) r [0] = x;
+			if (y < r [1]) r [1] = y;
+			if (x > r [2]) r [2] = x;
+			if (y > r [3]) r [3] = y;
+		}
+		n += a->strokes [s].count;
+	}
+	return n;
+}
+
+int animfile_save(const char *path, const struct anim *a)
+{
+	struct buf header = { NULL, 0, 0, 0 };
+	struct buf index = { NULL, 0, 0, 0 }, data = { NULL, 0, 0, 0 };
+	uint32_t *table = NULL, *offsets = NULL, *lengths = NULL;
+	uint32_t i, j, slots, start, length, hash, points, local;
+	const struct anim *fa;
+	char *tmp = NULL;
+	FILE *fp = NULL;
+	int r [4], ret = -1;
+
+	/* open addressing over frame numbers + 1, keyed by hash */
+	for (slots = 64; slots < a->nr_frames * 2; slots *= 2)
+		;
+	table = calloc(slots, sizeof(*table));
+	offsets = malloc((a->nr_frames + 1) * sizeof(*offsets));
+	lengths = malloc((a->nr_frames + 1) * sizeof(*lengths));
+	tmp = malloc(strlen(path) + 5);
+	if (table == NULL || offsets == NULL || lengths == NULL || tmp == NULL)
+		goto nomem;
+
+	for (i = 0; i < a->nr_frames; i++) {
+		if ((fa = anim_frame(a, i, &local)) == NULL) {
+			fprintf(stderr, "%s: frame %u is not available\n", path, i);
+			goto out;
+		}
+		start = data.len;
+		points = encode_frame(&data, fa, local, r);
+		if (data.failed)
+			goto nomem;
+		length = data.len - start;
+		hash = hash_bytes(data.p + start, length);
+
+		for (j = hash & (slots - 1); table [j]; j = (j + 1) & (slots - 1)) {
+			uint32_t k = table [j] - 1;
+
+			if (lengths [k] == length &&
+			    memcmp(data.p + offsets [k], data.p + start, length) == 0) {
+				/* seen before: drop the copy */
+				data.len = start;
+				start = offsets [k];
+				break;
+			}
+		}
+		if (table [j] == 0)
+			table [j] = i + 1;
+		offsets [i] = start;
+		lengths [i] = length;
+
+		put32(&index, start);
+		put32(&index, length);
+		put32(&index, hash);
+		put32(&index, points);
+		put16(&index, r [0]);
+		put16(&index, r [1]);
+		put16(&index, r [2]);
+		put16(&index, r [3]);
+	}
+
+	put(&header, "PANM", 4);
+	put32(&header, ANIMFILE_VERSION);
+	put32(&header, a->nr_frames);
+	put32(&header, HEADER_SIZE);
+	put32(&header, HEADER_SIZE + index.len);
+	put32(&header, data.len);
+	if (index.failed || header.failed)
+		goto nomem;
+
+	sprintf(tmp, "%s.new", path);
+	fp = fopen(tmp, "wb");
+	if (fp == NULL) {
+		perror(tmp);
+		goto out;
+	}
+	if (fwrite(header.p, 1, header.len, fp) != header.len ||
+	    (index.len && fwrite(index.p, 1, index.len, fp) != index.len) ||
+	    (data.len && fwrite(data.p, 1, data.len, fp) != data.len) ||
+	    fflush(fp) != 0 || fsync(fileno(fp)) < 0) {
+		perror(tmp);
+		fclose(fp);
+		unlink(tmp);
+		goto out;
+	}
+	if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+		perror(path);
+		unlink(tmp);
+		goto out;
+	}
+	ret = 0;
+	goto out;
+
+nomem:
+	fprintf(stderr, "%s: out of memory\n", path);
+out:
+	free(header.p);
+	free(index.p);
+	free(data.p);
+	free(table);
+	free(offsets);
+	free(lengths);
+	free(tmp);
+	return ret;
+}
+
+struct animfile *animfile_open(const char *path)
+{
+	struct animfile *f;
+	struct stat st;
+	uint32_t index_offset, data_offset;
+	void *base;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(path);
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size < HEADER_SIZE) {
+		fprintf(stderr, "%s: not an animation\n", path);
+		close(fd);
+		return NULL;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror(path);
+		return NULL;
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (f == NULL) {
+		perror("animfile_open");
+		munmap(base, st.st_size);
+		return NULL;
+	}
+	f->base = base;
+	f->length = st.st_size;
+	f->nr_frames = get32(f->base + 8);
+	index_offset = get32(f->base + 12);
+	data_offset = get32(f->base + 16);
+	f->data_length = get32(f->base + 20);
+
+	if (memcmp(f->base, "PANM", 4) != 0 ||
+	    get32(f->base + 4) != ANIMFILE_VERSION ||
+	    index_offset > f->length ||
+	    (f->length - index_offset) / INDEX_SIZE < f->nr_frames ||
+	    data_offset > f->length ||
+	    f->length - data_offset < f->data_length) {
+		fprintf(stderr, "%s: not an animation\n", path);
+		animfile_close(f);
+		return NULL;
+	}
+	f->index = f->base + index_offset;
+	f->data = f->base + data_offset;
+	return f;
+}
+
+void animfile_close(struct animfile *f)
+{
+	if (f == NULL)
+		return;
+	munmap((void *)f->base, f->length);
+	free(f);
+}
+
+uint32_t animfile_frames(const struct animfile *f)
+{
+	return f->nr_frames;
+}
+
+unsigned char *animfile_encode(const struct anim *a, uint32_t frame,
+			       size_t *length)
+{
+	struct buf b = { NULL, 0, 0, 0 };
+	int r [4];
+
+	encode_frame(&b, a, frame, r);
+	if (b.failed) {
+		free(b.p);
+		return NULL;
+	}
+	*length = b.len;
+	return b.p;
+}
+
+/* Add the strokes encoded in P to the drawing in progress of A, which
+ * has to be empty.  The number of points is returned and the bounding
+ * box goes to R, as encode_frame() gives them.  Returns -1 with the
+ * drawing discarded if the data is corrupt or memory runs out. */
+static int64_t decode_strokes(const unsigned char *p, size_t length,
+			      struct anim *a, int *r)
+{
+	const unsigned char *end = p + length;
+	uint32_t nr_strokes, count, s, i, ux, uy, n = 0;
+	int x = 0, y = 0;
+
+	r [0] = r [1] = 32767;
+	r [2] = r [3] = -32768;
+	if (!get_varint(&p, end, &nr_strokes))
+		return -1;
+	for (s = 0; s < nr_strokes; s++) {
+		if (!get_varint(&p, end, &count) || anim_begin_stroke(a) < 0)
+			goto fail;
+		for (i = 0; i < count; i++) {
+			if (!get_varint(&p, end, &ux) || !get_varint(&p, end, &uy) ||
+			    ux > 0x1ffff || uy > 0x1ffff)
+				goto fail;
+			x += (ux & 1) ? ~(int)(ux >> 1) : (int)(ux >> 1);
+			y += (uy & 1) ? ~(int)(uy >> 1) : (int)(uy >> 1);
+			if (x < -32768 || x > 32767 || y < -32768 || y > 32767 ||
+			    anim_add_point(a, x, y) < 0)
+				goto fail;
+			if (x < r [0]) r [0] = x;
+			if (y < r [1]) r [1] = y;
+			if (x > r [2]) r [2] = x;
+			if (y > r [3]) r [3] = y;
+		}
+		anim_end_stroke(a);
+		n += count;
+	}
+	return n;
+
+fail:
+	anim_discard(a);
+	return -1;
+}
+
+int animfile_decode(const unsigned char *p, size_t length, struct anim *a)
+{
+	int r [4];
+
+	if (decode_strokes(p, length, a, r) < 0)
+		return -1;
+	if (anim_commit(a) < 0) {
+		anim_discard(a);
+		return -1;
+	}
+	return 0;
+}
+
+/* The index entry of each frame repeats what its data must give: a
+ * frame is only taken if its hash, number of points and bounding box
+ * all match */
+int animfile_read_frame(const struct animfile *f, uint32_t frame,
+			struct anim *a)
+{
+	const unsigned char *e = f->index + frame * INDEX_SIZE;
+	uint32_t offset = get32(e), length = get32(e + 4);
+	int64_t points;
+	int r [4];
+
+	if (offset > f->data_length || f->data_length - offset < length ||
+	    hash_bytes(f->data + offset, length) != get32(e + 8))
+		goto corrupt;
+	points = decode_strokes(f->data + offset, length, a, r);
+	if (points < 0)
+		goto corrupt;
+	if (points != get32(e + 12) ||
+	    (points && (r [0] != get16(e + 16) || r [1] != get16(e + 18) ||
+			r [2] != get16(e + 20) || r [3] != get16(e + 22)))) {
+		anim_discard(a);
+		goto corrupt;
+	}
+	if (anim_commit(a) < 0) {
+		anim_discard(a);
+		goto corrupt;
+	}
+	return 0;
+
+corrupt:
+	fprintf(stderr, "animfile: frame %u could not be read\n", frame);
+	return -1;
+}
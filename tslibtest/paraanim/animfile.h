@@ -0,0 +1,76 @@
+/*
+ * animfile.h
+ *
+ * Compact on-disk animations, mapped and decoded frame by frame
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _ANIMFILE_H
+#define _ANIMFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "anim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* File layout, all numbers little-endian:
+ *
+ *   header	"PANM", version, number of frames, offset of the index,
+ *		offset and length of the data, 4 bytes each
+ *   index	per frame: offset and length of its data, a hash of that
+ *		data, number of points (4 bytes each) and bounding box
+ *		x1, y1, x2, y2 (2 bytes each, x1 > x2 if empty)
+ *   data	per frame: number of strokes, then per stroke its number
+ *		of points and the points, each as the difference to the
+ *		point before (the first one to 0,0), all as varints
+ *
+ * Frames with identical data share it.
+ */
+#define ANIMFILE_VERSION 1
+
+struct animfile;
+
+/* Write the frames of A (not the drawing in progress) to PATH,
+ * replacing it only once the new file is complete.  Returns -1 with a
+ * message on stderr on failure.
+ */
+int animfile_save(const char *path, const struct anim *a);
+
+/* Map the animation at PATH read-only.  Only the header is looked at;
+ * frames are decoded when asked for.  Returns NULL (with a message on
+ * stderr) if the file is missing or not an animation.
+ */
+struct animfile *animfile_open(const char *path);
+void animfile_close(struct animfile *f);
+
+uint32_t animfile_frames(const struct animfile *f);
+
+/* Decode FRAME and append it to A as its next frame.  A must have no
+ * drawing in progress.  Returns -1 if the frame is corrupt, which
+ * includes not matching the hash, number of points or bounding box in
+ * its index entry (A is left as it was), or memory runs out.
+ */
+int animfile_read_frame(const struct animfile *f, uint32_t frame,
+			struct anim *a);
+
+/* The data of FRAME (held in A's arrays) as stored in the file, in a
+ * buffer for free(); NULL if memory runs out */
+unsigned char *animfile_encode(const struct anim *a, uint32_t frame,
+			       size_t *length);
+/* Append the frame encoded in P to A, as animfile_read_frame() does */
+int animfile_decode(const unsigned char *p, size_t length, struct anim *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ANIMFILE_H */
@@ -0,0 +1,172 @@
+/*
+ * damage.c
+ *
+ * Damage region accumulator for EPD updates
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <string.h>
+
+#include "damage.h"
+
+static int screen_w, screen_h;
+static struct damage_params params = { 8, 8, 32768 };
+static struct damage_stats stats;
+static struct fb_rect regions_acc [DAMAGE_MAX_REGIONS];
+static int nr_regions;
+
+static long area(const struct fb_rect *r)
+{
+	return (long)r->w * r->h;
+}
+
+static void rect_union(struct fb_rect *d, const struct fb_rect *a,
+		       const struct fb_rect *b)
+{
+	int x1 = a->x < b->x ? a->x : b->x;
+	int y1 = a->y < b->y ? a->y : b->y;
+	int x2 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+	int y2 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+
+	d->x = x1;
+	d->y = y1;
+	d->w = x2 - x1;
+	d->h = y2 - y1;
+}
+
+/* Extra cost of updating the union of A and B instead of both */
+static long merge_cost(const struct fb_rect *a, const struct fb_rect *b)
+{
+	struct fb_rect u;
+
+	rect_union(&u, a, b);
+	return area(&u) - area(a) - area(b) - params.update_cost;
+}
+
+void damage_init(int width, int height)
+{
+	screen_w = width;
+	screen_h = height;
+	nr_regions = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+void damage_get_params(struct damage_params *p)
+{
+	*p = params;
+}
+
+void damage_set_params(const struct damage_params *p)
+{
+	params = *p;
+	if (params.max_regions < 1)
+		params.max_regions = 1;
+	if (params.max_regions > DAMAGE_MAX_REGIONS)
+		params.max_regions = DAMAGE_MAX_REGIONS;
+	if (params.align < 1)
+		params.align = 1;
+	if (params.update_cost < 0)
+		params.update_cost = 0;
+}
+
+/* Add the area x1..x2, y1..y2 (inclusive).  The rectangle is clipped and
+ * aligned, then folded into every accumulated region it is cheaper to
+ * merge with.  If the table is still full, it joins the region whose
+ * merge costs the least.
+ */
+void damage_add(int x1, int y1, int x2, int y2)
+{
+	struct fb_rect r;
+	long cost, best_cost;
+	int i, best;
+
+	if (x1 < 0) x1 = 0;
+	if (y1 < 0) y1 = 0;
+	if (x2 >= screen_w) x2 = screen_w - 1;
+	if (y2 >= screen_h) y2 = screen_h - 1;
+	if (x1 > x2 || y1 > y2)
+		return;
+
+	x1 -= x1 % params.align;
+	x2 += params.align - 1 - x2 % params.align;
+	if (x2 >= screen_w)
+		x2 = screen_w - 1;
+
+	r.x = x1;
+	r.y = y1;
+	r.w = x2 - x1 + 1;
+	r.h = y2 - y1 + 1;
+
+	for (;;) {
+		best = -1;
+		best_cost = 0;
+		for (i = 0; i < nr_regions; i++) {
+			cost = merge_cost(&r, &regions_acc [i]);
+			if (best < 0 || cost < best_cost) {
+				best = i;
+				best_cost = cost;
+			}
+		}
+		if (best < 0 || (best_cost > 0 && nr_regions < params.max_regions))
+			break;
+
+		/* Take the region out and retry with the union, which may now
+		 * be worth merging with others as well */
+		rect_union(&r, &r, &regions_acc [best]);
+		regions_acc [best] = regions_acc [--nr_regions];
+	}
+
+	regions_acc [nr_regions++] = r;
+}
+
+/* Hand out the accumulated regions, at most DAMAGE_MAX_REGIONS of them,
+ * and start over.  Returns the number of regions stored in REGIONS.
+ */
+int damage_collect(struct fb_rect *regions)
+{
+	long pixels = 0;
+	int i, n = nr_regions;
+
+	if (n == 0)
+		return 0;
+
+	for (i = 0; i < n; i++)
+		pixels += area(&regions_acc [i]);
+
+	if ((long)n * params.update_cost + pixels >=
+	    params.update_cost + (long)screen_w * screen_h) {
+		regions [0].x = 0;
+		regions [0].y = 0;
+		regions [0].w = screen_w;
+		regions [0].h = screen_h;
+		n = 1;
+		pixels = (long)screen_w * screen_h;
+		stats.full_updates++;
+	} else {
+		memcpy(regions, regions_acc, n * sizeof(*regions));
+	}
+
+	stats.flushes++;
+	stats.updates += n;
+	stats.pixels += pixels;
+	stats.last_updates = n;
+	stats.last_pixels = pixels;
+
+	nr_regions = 0;
+	return n;
+}
+
+int damage_pending(void)
+{
+	return nr_regions;
+}
+
+const struct damage_stats *damage_get_stats(void)
+{
+	return &stats;
+}
@@ -0,0 +1,60 @@
+/*
+ * damage.h
+ *
+ * Damage region accumulator for EPD updates
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _DAMAGE_H
+#define _DAMAGE_H
+
+#include "fbutils.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Upper bound for damage_params.max_regions */
+#define DAMAGE_MAX_REGIONS 32
+
+/* Cost model: one update costs update_cost pixel-equivalents on top of
+ * one unit per pixel it covers.  Two regions are merged whenever their
+ * union costs no more than updating both, and a flush turns into a single
+ * full-screen update when that is cheaper than the partial ones.
+ * open_framebuffer() takes them from TSLIB_DAMAGE, e.g.
+ * TSLIB_DAMAGE=regions=16,align=8,cost=20000.
+ */
+struct damage_params {
+	int max_regions;	/* regions kept before forced merging */
+	int align;		/* x and width are rounded to this many pixels */
+	int update_cost;	/* fixed cost of one update, in pixels */
+};
+
+struct damage_stats {
+	unsigned long flushes;		/* non-empty flushes */
+	unsigned long updates;		/* regions handed out in total */
+	unsigned long full_updates;	/* flushes promoted to full screen */
+	unsigned long long pixels;	/* pixels covered in total */
+	int last_updates;		/* regions in the last flush */
+	long last_pixels;		/* pixels in the last flush */
+};
+
+void damage_init(int width, int height);
+void damage_get_params(struct damage_params *params);
+void damage_set_params(const struct damage_params *params);
+void damage_add(int x1, int y1, int x2, int y2);
+int damage_collect(struct fb_rect *regions);
+/* Nonzero while there is damage waiting for damage_collect() */
+int damage_pending(void);
+const struct damage_stats *damage_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DAMAGE_H */
@@ -0,0 +1,325 @@
+/*
+ * epd.c
+ *
+ * Asynchronous EPD update submission for the i.MX EPDC
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+
+#include <linux/mxcfb.h>
+
+#include "fbutils.h"
+#include "epd.h"
+#include "trace.h"
+#include "fbsim.h"
+
+/* Markers submitted but not yet waited for, oldest first */
+#define EPD_QUEUE_SIZE 64
+
+/* Waveform numbers of the i.MX50 EPDC; A2 is the fastest, black and
+ * white only */
+#define EPD_WAVEFORM_A2 4
+
+static int epd_fd = -1;
+static epd_marker_t next_marker = 1;
+static epd_marker_t completed;
+static epd_marker_t queue [EPD_QUEUE_SIZE];
+static unsigned q_head, q_tail;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+static int worker_running, worker_stop;
+static int event_fd = -1;
+static epd_callback_t callback;
+static void *callback_arg;
+
+/* Where the update trace goes (EPD_TRACE), NULL for nowhere */
+static const char *trace_path;
+static int trace_csv;
+static unsigned long trace_reported;
+
+/* Completed updates between writing out the trace, well within what
+ * the ring holds */
+#define TRACE_DRAIN_EVERY (TRACE_SIZE / 4)
+
+/* Updates are retired in submission order, so everything up to and
+ * including `completed' is done. */
+static int is_done(epd_marker_t marker)
+{
+	return (int32_t)(completed - marker) >= 0;
+}
+
+static void wait_marker(epd_marker_t marker)
+{
+	/* The driver reports an error for markers it no longer knows
+	 * about, which only happens once they have completed. */
+	fb_ioctl(epd_fd, MXCFB_WAIT_FOR_UPDATE_COMPLETE, &marker);
+}
+
+static void drain_trace(void)
+{
+	trace_drain(trace_path, trace_csv);
+	if (trace_lost() != trace_reported) {
+		trace_reported = trace_lost();
+		fprintf(stderr, "%s: %lu updates lost from the trace\n",
+			trace_path, trace_reported);
+	}
+}
+
+/* Record MARKER as completed; every so often the trace is written out
+ * before the ring wraps around.  Called by whichever thread retires
+ * updates, without the lock. */
+static void traced_complete(epd_marker_t marker)
+{
+	trace_complete(marker);
+	if (trace_path && marker % TRACE_DRAIN_EVERY == 0)
+		drain_trace();
+}
+
+/* Wait for the oldest queued update on the calling thread.  Called with
+ * the lock held and no completion thread running. */
+static void retire_oldest(void)
+{
+	epd_marker_t marker = queue [q_head % EPD_QUEUE_SIZE];
+
+	pthread_mutex_unlock(&lock);
+	wait_marker(marker);
+	traced_complete(marker);
+	pthread_mutex_lock(&lock);
+	q_head++;
+	completed = marker;
+}
+
+/* Set EPD_TRACE to a file name to get the update trace written there,
+ * as CSV if the name ends in .csv.  It is appended to as updates
+ * complete and once more on exit.
+ */
+void epd_init(int fd)
+{
+	size_t len;
+
+	epd_fd = fd;
+	if ((trace_path = getenv("EPD_TRACE")) != NULL) {
+		len = strlen(trace_path);
+		trace_csv = len > 4 && strcmp(trace_path + len - 4, ".csv") == 0;
+	}
+}
+
+void epd_exit(void)
+{
+	if (worker_running) {
+		pthread_mutex_lock(&lock);
+		worker_stop = 1;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+		pthread_join(worker, NULL);
+		worker_running = 0;
+		worker_stop = 0;
+	}
+	if (event_fd >= 0) {
+		close(event_fd);
+		event_fd = -1;
+	}
+	epd_fd = -1;
+
+	if (trace_path)
+		drain_trace();
+	trace_path = NULL;
+}
+
+static epd_marker_t submit(int x, int y, int w, int h, int mode,
+			   const struct epd_source *src)
+{
+	struct mxcfb_update_data param;
+	epd_marker_t marker;
+	uint64_t start;
+
+	if (epd_fd < 0)
+		return 0;
+
+	memset(&param, 0, sizeof(param));
+	param.update_region.left = x;
+	param.update_region.top = y;
+	param.update_region.width = w;
+	param.update_region.height = h;
+	if (mode & MXC_DAMAGE_MODE_FULL)
+		param.update_mode = UPDATE_MODE_FULL;
+	else
+		param.update_mode = UPDATE_MODE_PARTIAL;
+	param.temp = 0;
+	if (mode & MXC_DAMAGE_MODE_MONOCHROME) {
+		param.waveform_mode = EPD_WAVEFORM_A2;
+		param.flags = EPDC_FLAG_FORCE_MONOCHROME;
+	} else {
+		param.waveform_mode = WAVEFORM_MODE_AUTO;
+		param.flags = 0;
+	}
+	if (src) {
+		param.flags |= EPDC_FLAG_USE_ALT_BUFFER;
+		param.alt_buffer_data.phys_addr = src->phys;
+		param.alt_buffer_data.width = src->width;
+		param.alt_buffer_data.height = src->height;
+		param.alt_buffer_data.alt_update_region.left = src->x;
+		param.alt_buffer_data.alt_update_region.top = src->y;
+		param.alt_buffer_data.alt_update_region.width = w;
+		param.alt_buffer_data.alt_update_region.height = h;
+	}
+
+	pthread_mutex_lock(&lock);
+
+	/* Never have more updates in flight than we can keep track of */
+	while (q_tail - q_head == EPD_QUEUE_SIZE) {
+		if (worker_running)
+			pthread_cond_wait(&cond, &lock);
+		else
+			retire_oldest();
+	}
+
+	marker = next_marker++;
+	if (next_marker == 0)
+		next_marker = 1;
+	param.update_marker = marker;
+
+	start = trace_now();
+	if (fb_ioctl(epd_fd, MXCFB_SEND_UPDATE, &param) < 0) {
+		perror("ioctl MXCFB_SEND_UPDATE");
+		pthread_mutex_unlock(&lock);
+		return 0;
+	}
+	trace_submit(marker, x, y, w, h, mode, param.waveform_mode, start);
+
+	queue [q_tail++ % EPD_QUEUE_SIZE] = marker;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	return marker;
+}
+
+epd_marker_t epd_submit(int x, int y, int w, int h, int mode)
+{
+	return submit(x, y, w, h, mode, NULL);
+}
+
+epd_marker_t epd_submit_alt(int x, int y, int w, int h, int mode,
+			    const struct epd_source *src)
+{
+	return submit(x, y, w, h, mode, src);
+}
+
+int epd_poll(epd_marker_t marker)
+{
+	int done;
+
+	if (marker == 0)
+		return 1;
+
+	pthread_mutex_lock(&lock);
+	done = is_done(marker);
+	pthread_mutex_unlock(&lock);
+
+	return done;
+}
+
+int epd_wait(epd_marker_t marker)
+{
+	if (marker == 0 || epd_fd < 0)
+		return 0;
+
+	pthread_mutex_lock(&lock);
+	while (!is_done(marker) && q_head != q_tail) {
+		if (worker_running)
+			pthread_cond_wait(&cond, &lock);
+		else
+			retire_oldest();
+	}
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+static void *completion_thread(void *arg)
+{
+	epd_marker_t marker;
+	epd_callback_t cb;
+	void *cb_arg;
+	uint64_t one = 1;
+
+	(void)arg;
+
+	pthread_mutex_lock(&lock);
+	while (!worker_stop) {
+		if (q_head == q_tail) {
+			pthread_cond_wait(&cond, &lock);
+			continue;
+		}
+
+		/* Leave the marker queued while waiting, it is still in
+		 * flight as far as epd_submit() is concerned */
+		marker = queue [q_head % EPD_QUEUE_SIZE];
+		pthread_mutex_unlock(&lock);
+		wait_marker(marker);
+		traced_complete(marker);
+		pthread_mutex_lock(&lock);
+
+		q_head++;
+		completed = marker;
+		pthread_cond_broadcast(&cond);
+		cb = callback;
+		cb_arg = callback_arg;
+
+		pthread_mutex_unlock(&lock);
+		if (event_fd >= 0 && write(event_fd, &one, sizeof(one)) < 0)
+			perror("write eventfd");
+		if (cb)
+			cb(marker, cb_arg);
+		pthread_mutex_lock(&lock);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+int epd_start_completion_thread(void)
+{
+	if (worker_running)
+		return event_fd;
+
+	event_fd = eventfd(0, 0);
+	if (event_fd < 0) {
+		perror("eventfd");
+		return -1;
+	}
+
+	worker_stop = 0;
+	if (pthread_create(&worker, NULL, completion_thread, NULL) != 0) {
+		perror("pthread_create");
+		close(event_fd);
+		event_fd = -1;
+		return -1;
+	}
+	worker_running = 1;
+
+	return event_fd;
+}
+
+void epd_set_completion_callback(epd_callback_t cb, void *arg)
+{
+	pthread_mutex_lock(&lock);
+	callback = cb;
+	callback_arg = arg;
+	pthread_mutex_unlock(&lock);
+}
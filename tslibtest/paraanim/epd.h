@@ -0,0 +1,68 @@
+/*
+ * epd.h
+ *
+ * Asynchronous EPD update submission for the i.MX EPDC
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _EPD_H
+#define _EPD_H
+
+#include <asm/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Every update gets its own marker from a monotonic counter, so updates
+ * in flight can be told apart.  Markers are never 0; 0 is returned when
+ * an update could not be submitted.
+ */
+typedef __u32 epd_marker_t;
+
+typedef void (*epd_callback_t)(epd_marker_t marker, void *arg);
+
+void epd_init(int fd);
+void epd_exit(void);
+
+/* mode takes the MXC_DAMAGE_MODE_* flags from fbutils.h */
+epd_marker_t epd_submit(int x, int y, int w, int h, int mode);
+
+/* Where an update takes its pixels from instead of the framebuffer:
+ * WIDTH x HEIGHT pixels at physical address PHYS, packed row after row,
+ * starting at X, Y in there */
+struct epd_source {
+	__u32 phys;
+	int width, height;
+	int x, y;
+};
+
+/* epd_submit() with EPDC_FLAG_USE_ALT_BUFFER.  Returns 0 if the driver
+ * refuses, for instance because it has no alternate buffer support. */
+epd_marker_t epd_submit_alt(int x, int y, int w, int h, int mode,
+			    const struct epd_source *src);
+
+/* 1 once MARKER has completed, 0 while it is still in flight.  Without
+ * the completion thread an update only counts as completed after
+ * epd_wait() has been called for it.
+ */
+int epd_poll(epd_marker_t marker);
+int epd_wait(epd_marker_t marker);
+
+/* Start a thread that waits for submitted updates in the background.
+ * Each completion is signalled on the returned eventfd and reported to
+ * the callback, if one is set.  Returns -1 on failure.
+ */
+int epd_start_completion_thread(void);
+void epd_set_completion_callback(epd_callback_t callback, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _EPD_H */
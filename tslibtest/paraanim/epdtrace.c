@@ -0,0 +1,140 @@
+/*
+ * epdtrace.c
+ *
+ * Print EPD update latency percentiles from a binary trace file
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ *
+ * Usage: epdtrace trace.bin
+ *
+ * The trace is written by paraanim on exit when EPD_TRACE is set.
+ * Latencies are grouped by waveform mode and by region size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+struct bucket {
+	const char *name;
+	unsigned long max_pixels;
+};
+
+static const struct bucket buckets[] = {
+	{ "<=4K px",	4096 },
+	{ "<=64K px",	65536 },
+	{ "<=256K px",	262144 },
+	{ ">256K px",	~0UL },
+};
+#define NR_BUCKETS (sizeof(buckets) / sizeof(buckets[0]))
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *v, int n, int pct)
+{
+	int i = (n * pct + 99) / 100 - 1;
+
+	return v[i < 0 ? 0 : i];
+}
+
+static int bucket_of(const struct trace_rec *r)
+{
+	unsigned long pixels = (unsigned long)r->w * r->h;
+	unsigned i;
+
+	for (i = 0; i < NR_BUCKETS - 1; i++)
+		if (pixels <= buckets[i].max_pixels)
+			break;
+	return i;
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_header hdr;
+	struct trace_rec *recs = NULL;
+	double *lat;
+	int nr_recs = 0, size = 0, i, n;
+	unsigned b;
+	int waveform, next_waveform;
+	FILE *f;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s trace.bin\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (f == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != TRACE_MAGIC ||
+	    hdr.version != TRACE_VERSION || hdr.rec_size != sizeof(struct trace_rec)) {
+		fprintf(stderr, "%s: not an EPD trace file\n", argv[1]);
+		return 1;
+	}
+
+	for (;;) {
+		if (nr_recs == size) {
+			size = size ? size * 2 : 256;
+			recs = realloc(recs, size * sizeof(*recs));
+			if (recs == NULL) {
+				perror("realloc");
+				return 1;
+			}
+		}
+		if (fread(&recs[nr_recs], sizeof(*recs), 1, f) != 1)
+			break;
+		if (recs[nr_recs].complete_ns != 0)
+			nr_recs++;
+	}
+	fclose(f);
+
+	lat = malloc((nr_recs + 1) * sizeof(*lat));
+	if (lat == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	printf("%d updates\n", nr_recs);
+	printf("waveform  region        count   p50 ms   p90 ms   p99 ms   max ms\n");
+
+	/* Walk the waveform modes in ascending order */
+	for (waveform = -1; ; waveform = next_waveform) {
+		next_waveform = 0x10000;
+		for (i = 0; i < nr_recs; i++)
+			if (recs[i].waveform > waveform && recs[i].waveform < next_waveform)
+				next_waveform = recs[i].waveform;
+		if (next_waveform == 0x10000)
+			break;
+
+		for (b = 0; b < NR_BUCKETS; b++) {
+			n = 0;
+			for (i = 0; i < nr_recs; i++)
+				if (recs[i].waveform == next_waveform &&
+				    bucket_of(&recs[i]) == (int)b)
+					lat[n++] = (recs[i].complete_ns - recs[i].submit_ns) / 1e6;
+			if (n == 0)
+				continue;
+			qsort(lat, n, sizeof(*lat), compare_double);
+			printf("%8d  %-10s  %7d  %7.1f  %7.1f  %7.1f  %7.1f\n",
+			       next_waveform, buckets[b].name, n,
+			       percentile(lat, n, 50), percentile(lat, n, 90),
+			       percentile(lat, n, 99), lat[n - 1]);
+		}
+	}
+
+	free(lat);
+	free(recs);
+	return 0;
+}
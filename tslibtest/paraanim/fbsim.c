@@ -0,0 +1,461 @@
+/*
+ * fbsim.c
+ *
+ * Memory-backed fbdev and i.MX EPDC emulator for running off-device
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/fb.h>
+#include <linux/mxcfb.h>
+
+#include "fbsim.h"
+
+#define SIM_MAX_UPDATES 64
+#define MS		1000000ULL
+/* Physical address the memory pretends to be at, for updates from
+ * alternate buffers */
+#define SIM_PHYS	0x70000000UL
+
+struct sim_update {
+	__u32 marker;
+	struct mxcfb_rect r;
+	uint64_t start, end;
+};
+
+struct sim_timing {
+	uint64_t init, du, gc16, gc4, a2, autowf;
+	uint64_t mpix;
+	uint64_t setup;
+	int luts;
+	int collide;
+};
+
+static int sim_fd = -1;
+static struct fb_fix_screeninfo sim_fix;
+static struct fb_var_screeninfo sim_var;
+static unsigned char *sim_mem, *sim_panel;
+static uint64_t sim_now;
+static struct sim_update updates [SIM_MAX_UPDATES];
+static int nr_updates;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Rough figures for an E Ink Pearl panel on the i.MX50 EPDC */
+static struct sim_timing timing = {
+	2000 * MS, 260 * MS, 450 * MS, 290 * MS, 120 * MS, 450 * MS,
+	20 * MS, 1 * MS, 16, 1
+};
+
+static void parse_timing(const char *s)
+{
+	char key [16];
+	unsigned long value;
+	int n;
+
+	while (s && sscanf(s, "%15[a-z0-9]=%lu%n", key, &value, &n) == 2) {
+		if (!strcmp(key, "init")) timing.init = value * MS;
+		else if (!strcmp(key, "du")) timing.du = value * MS;
+		else if (!strcmp(key, "gc16")) timing.gc16 = value * MS;
+		else if (!strcmp(key, "gc4")) timing.gc4 = value * MS;
+		else if (!strcmp(key, "a2")) timing.a2 = value * MS;
+		else if (!strcmp(key, "auto")) timing.autowf = value * MS;
+		else if (!strcmp(key, "mpix")) timing.mpix = value * MS;
+		else if (!strcmp(key, "setup")) timing.setup = value * MS;
+		else if (!strcmp(key, "luts")) timing.luts = value ? value : 1;
+		else if (!strcmp(key, "collide")) timing.collide = value;
+		else fprintf(stderr, "fbsim: unknown timing key %s\n", key);
+		s += n;
+		if (*s != ',')
+			break;
+		s++;
+	}
+}
+
+static void set_bitfield(struct fb_bitfield *f, int offset, int length)
+{
+	f->offset = offset;
+	f->length = length;
+	f->msb_right = 0;
+}
+
+static int sim_setup(const char *spec)
+{
+	unsigned w, h, bpp = 8, pages = 2;
+
+	if (sscanf(spec, "%ux%ux%ux%u", &w, &h, &bpp, &pages) < 2 ||
+	    w == 0 || h == 0 || pages == 0) {
+		fprintf(stderr, "fbsim: bad device spec \"%s\"\n", spec);
+		return -1;
+	}
+	if (bpp != 1 && bpp != 2 && bpp != 4 && bpp != 8 &&
+	    bpp != 16 && bpp != 32) {
+		fprintf(stderr, "fbsim: unsupported depth %u\n", bpp);
+		return -1;
+	}
+
+	memset(&sim_var, 0, sizeof(sim_var));
+	sim_var.xres = sim_var.xres_virtual = w;
+	sim_var.yres = h;
+	sim_var.yres_virtual = h * pages;
+	sim_var.bits_per_pixel = bpp;
+	switch (bpp) {
+	case 1:
+	case 2:
+	case 4:
+	case 8:
+		sim_var.grayscale = 1;
+		set_bitfield(&sim_var.red, 0, bpp);
+		set_bitfield(&sim_var.green, 0, bpp);
+		set_bitfield(&sim_var.blue, 0, bpp);
+		break;
+	case 16:
+		set_bitfield(&sim_var.red, 11, 5);
+		set_bitfield(&sim_var.green, 5, 6);
+		set_bitfield(&sim_var.blue, 0, 5);
+		break;
+	case 32:
+		set_bitfield(&sim_var.red, 16, 8);
+		set_bitfield(&sim_var.green, 8, 8);
+		set_bitfield(&sim_var.blue, 0, 8);
+		break;
+	}
+
+	memset(&sim_fix, 0, sizeof(sim_fix));
+	strcpy(sim_fix.id, "fbsim");
+	sim_fix.type = FB_TYPE_PACKED_PIXELS;
+	sim_fix.visual = bpp <= 8 ? FB_VISUAL_STATIC_PSEUDOCOLOR : FB_VISUAL_TRUECOLOR;
+	sim_fix.line_length = (w * bpp + 7) / 8;
+	sim_fix.smem_len = sim_fix.line_length * sim_var.yres_virtual;
+	sim_fix.smem_start = SIM_PHYS;
+
+	sim_mem = calloc(1, sim_fix.smem_len);
+	sim_panel = calloc(1, sim_fix.line_length * h);
+	if (sim_mem == NULL || sim_panel == NULL) {
+		perror("fbsim");
+		free(sim_mem);
+		free(sim_panel);
+		sim_mem = sim_panel = NULL;
+		return -1;
+	}
+
+	sim_now = 0;
+	nr_updates = 0;
+	parse_timing(getenv("FBSIM_TIMING"));
+	return 0;
+}
+
+static uint64_t waveform_time(const struct mxcfb_update_data *u)
+{
+	uint64_t t;
+
+	switch (u->waveform_mode) {
+	case 0: t = timing.init; break;
+	case 1: t = timing.du; break;
+	case 2: t = timing.gc16; break;
+	case 3: t = timing.gc4; break;
+	case 4: t = timing.a2; break;
+	default: t = timing.autowf; break;
+	}
+	return t + timing.mpix * u->update_region.width *
+		u->update_region.height / 1000000;
+}
+
+static int overlaps(const struct mxcfb_rect *a, const struct mxcfb_rect *b)
+{
+	return a->left < b->left + b->width && b->left < a->left + a->width &&
+		a->top < b->top + b->height && b->top < a->top + a->height;
+}
+
+/* Where the pixels of an update come from, how far apart their rows
+ * are and at which pixel of its row the first one is: the visible
+ * page, or the alternate buffer if the update asks for it (which has
+ * to lie in the framebuffer memory here) */
+static const unsigned char *update_source(const struct mxcfb_update_data *u,
+					  size_t *pitch, unsigned *x)
+{
+	const struct mxcfb_alt_buffer_data *alt = &u->alt_buffer_data;
+	const struct mxcfb_rect *a = &alt->alt_update_region;
+	unsigned bpp = sim_var.bits_per_pixel;
+
+	if (!(u->flags & EPDC_FLAG_USE_ALT_BUFFER)) {
+		*pitch = sim_fix.line_length;
+		*x = u->update_region.left;
+		return sim_mem + (sim_var.yoffset + u->update_region.top) *
+			sim_fix.line_length;
+	}
+	*pitch = (alt->width * bpp + 7) / 8;
+	if (a->width != u->update_region.width ||
+	    a->height != u->update_region.height ||
+	    a->left + a->width > alt->width || a->top + a->height > alt->height ||
+	    alt->phys_addr < SIM_PHYS ||
+	    alt->phys_addr - SIM_PHYS + (uint64_t)*pitch * alt->height >
+	    sim_fix.smem_len)
+		return NULL;
+	*x = a->left;
+	return sim_mem + (alt->phys_addr - SIM_PHYS) + a->top * *pitch;
+}
+
+/* Copy N pixels from pixel SX of the row SRC to pixel DX of the row
+ * DST; below 8 bpp they need not start at the same bit of a byte */
+static void copy_pixels(unsigned char *dst, unsigned dx,
+			const unsigned char *src, unsigned sx, unsigned n)
+{
+	unsigned bpp = sim_var.bits_per_pixel, mask = (1u << bpp) - 1, v, s;
+
+	if (bpp >= 8) {
+		memcpy(dst + dx * bpp / 8, src + sx * bpp / 8, n * bpp / 8);
+		return;
+	}
+	for (; n--; sx++, dx++) {
+		v = src [sx * bpp / 8] >> (8 - bpp - sx * bpp % 8) & mask;
+		s = 8 - bpp - dx * bpp % 8;
+		dst [dx * bpp / 8] = (dst [dx * bpp / 8] & ~(mask << s)) | v << s;
+	}
+}
+
+/* Schedule an update: it starts after the setup time, once every
+ * overlapping update has finished (if collisions serialize) and once a
+ * LUT is free. */
+static int sim_send_update(const struct mxcfb_update_data *u)
+{
+	const struct mxcfb_rect *r = &u->update_region;
+	const unsigned char *src;
+	struct sim_update *s;
+	uint64_t start, next;
+	size_t pitch;
+	unsigned x;
+	int i, active;
+
+	src = update_source(u, &pitch, &x);
+	if (r->left + r->width > sim_var.xres || r->top + r->height > sim_var.yres ||
+	    r->width == 0 || r->height == 0 || src == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* The driver forgets updates once they are done */
+	for (i = 0; i < nr_updates; )
+		if (updates [i].end <= sim_now)
+			updates [i] = updates [--nr_updates];
+		else
+			i++;
+	if (nr_updates == SIM_MAX_UPDATES) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	start = sim_now + timing.setup;
+	if (timing.collide)
+		for (i = 0; i < nr_updates; i++)
+			if (overlaps(r, &updates [i].r) && updates [i].end > start)
+				start = updates [i].end;
+	for (;;) {
+		active = 0;
+		next = ~0ULL;
+		for (i = 0; i < nr_updates; i++)
+			if (updates [i].start <= start && start < updates [i].end) {
+				active++;
+				if (updates [i].end < next)
+					next = updates [i].end;
+			}
+		if (active < timing.luts)
+			break;
+		start = next;
+	}
+
+	s = &updates [nr_updates++];
+	s->marker = u->update_marker;
+	s->r = *r;
+	s->start = start;
+	s->end = start + waveform_time(u);
+
+	/* The controller picks the pixels up when the update is submitted */
+	for (i = 0; i < (int)r->height; i++)
+		copy_pixels(sim_panel + (r->top + i) * sim_fix.line_length,
+			    r->left, src + i * pitch, x, r->width);
+	return 0;
+}
+
+static int sim_wait_update(__u32 marker)
+{
+	int i;
+
+	for (i = 0; i < nr_updates; i++)
+		if (updates [i].marker == marker) {
+			if (updates [i].end > sim_now)
+				sim_now = updates [i].end;
+			updates [i] = updates [--nr_updates];
+			return 0;
+		}
+	errno = EINVAL;
+	return -1;
+}
+
+static int sim_pan(const struct fb_var_screeninfo *v)
+{
+	if (v->xoffset + sim_var.xres > sim_var.xres_virtual ||
+	    v->yoffset + sim_var.yres > sim_var.yres_virtual) {
+		errno = EINVAL;
+		return -1;
+	}
+	sim_var.xoffset = v->xoffset;
+	sim_var.yoffset = v->yoffset;
+	return 0;
+}
+
+static int sim_ioctl(unsigned long request, void *arg)
+{
+	switch (request) {
+	case FBIOGET_FSCREENINFO:
+		memcpy(arg, &sim_fix, sizeof(sim_fix));
+		return 0;
+	case FBIOGET_VSCREENINFO:
+		memcpy(arg, &sim_var, sizeof(sim_var));
+		return 0;
+	case FBIOPUTCMAP:
+		return 0;
+	case FBIOPAN_DISPLAY:
+		return sim_pan(arg);
+	case MXCFB_SEND_UPDATE:
+		return sim_send_update(arg);
+	case MXCFB_WAIT_FOR_UPDATE_COMPLETE:
+		return sim_wait_update(*(__u32 *)arg);
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+
+/* Pixel values go out a byte each, so a dump at 4 bpp compares equal
+ * to one at 8 bpp of the same gray levels */
+static void sim_dump(const char *path)
+{
+	unsigned bpp = sim_var.bits_per_pixel, x, y;
+	const unsigned char *row;
+	FILE *f;
+
+	if (bpp > 8)
+		return;
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		perror(path);
+		return;
+	}
+	fprintf(f, "P5\n%u %u\n255\n", sim_var.xres, sim_var.yres);
+	for (y = 0; y < sim_var.yres; y++) {
+		row = sim_panel + y * sim_fix.line_length;
+		if (bpp == 8) {
+			fwrite(row, 1, sim_var.xres, f);
+			continue;
+		}
+		for (x = 0; x < sim_var.xres; x++)
+			putc(row [x * bpp / 8] >> (8 - bpp - x * bpp % 8) &
+			     ((1u << bpp) - 1), f);
+	}
+	fclose(f);
+}
+
+int fb_open(const char *device, int flags)
+{
+	if (strncmp(device, "sim:", 4) != 0)
+		return open(device, flags);
+
+	if (sim_fd >= 0) {
+		errno = EBUSY;
+		return -1;
+	}
+	if (sim_setup(device + 4) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* A real descriptor keeps the number unique */
+	sim_fd = open("/dev/null", O_RDWR);
+	return sim_fd;
+}
+
+int fb_ioctl(int fd, unsigned long request, void *arg)
+{
+	int r;
+
+	if (fd < 0 || fd != sim_fd)
+		return ioctl(fd, request, arg);
+
+	pthread_mutex_lock(&sim_lock);
+	r = sim_ioctl(request, arg);
+	pthread_mutex_unlock(&sim_lock);
+	return r;
+}
+
+void *fb_mmap(size_t length, int fd)
+{
+	if (fd < 0 || fd != sim_fd)
+		return mmap(NULL, length, PROT_READ | PROT_WRITE,
+			    MAP_FILE | MAP_SHARED, fd, 0);
+
+	if (length > sim_fix.smem_len) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+	return sim_mem;
+}
+
+int fb_munmap(void *addr, size_t length)
+{
+	if (sim_fd < 0 || addr != sim_mem)
+		return munmap(addr, length);
+	return 0;
+}
+
+int fb_close(int fd)
+{
+	const char *path;
+
+	if (fd < 0 || fd != sim_fd)
+		return close(fd);
+
+	if ((path = getenv("FBSIM_DUMP")) != NULL)
+		sim_dump(path);
+	free(sim_mem);
+	free(sim_panel);
+	sim_mem = sim_panel = NULL;
+	sim_fd = -1;
+	return close(fd);
+}
+
+int fbsim_active(void)
+{
+	return sim_fd >= 0;
+}
+
+uint64_t fbsim_clock_ns(void)
+{
+	uint64_t now;
+
+	pthread_mutex_lock(&sim_lock);
+	now = sim_now;
+	pthread_mutex_unlock(&sim_lock);
+	return now;
+}
+
+void fbsim_sleep_until(uint64_t ns)
+{
+	pthread_mutex_lock(&sim_lock);
+	if (ns > sim_now)
+		sim_now = ns;
+	pthread_mutex_unlock(&sim_lock);
+}
@@ -0,0 +1,63 @@
+/*
+ * fbsim.h
+ *
+ * Memory-backed fbdev and i.MX EPDC emulator for running off-device
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ *
+ * Opening a device named "sim:WIDTHxHEIGHTxBPP[xPAGES]" (for instance
+ * TSLIB_FBDEVICE=sim:800x600x8; BPP is 1, 2, 4 or 8 for gray levels,
+ * 16 or 32 for RGB) gives a framebuffer in plain memory that answers
+ * the FBIOGET_*SCREENINFO, FBIOPUTCMAP, FBIOPAN_DISPLAY and MXCFB_*
+ * ioctls.  Like the EPDC driver it has two pages by default; with one,
+ * panning fails.  Updates from an alternate buffer
+ * (EPDC_FLAG_USE_ALT_BUFFER) work if it lies in the framebuffer
+ * memory, which is at the physical address in smem_start.  EPD updates
+ * run on a virtual clock that only advances when an update is waited
+ * for, so timings are deterministic.  The timing model is read from
+ * FBSIM_TIMING, a comma separated list of key=value pairs:
+ *
+ *   init, du, gc16, gc4, a2, auto   waveform durations in ms
+ *   mpix                            extra ms per megapixel updated
+ *   setup                           ms from submission to start
+ *   luts                            updates the controller runs at once
+ *   collide                         1: overlapping updates serialize
+ *
+ * With FBSIM_DUMP=file.pgm, what reached the panel is written out as a
+ * PGM image when the device is closed (1, 2, 4 and 8 bpp only).
+ */
+
+#ifndef _FBSIM_H
+#define _FBSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Drop-in replacements for open(), ioctl(), mmap(), munmap() and
+ * close() on the framebuffer device; anything that is not the simulator
+ * is passed through to the real calls.
+ */
+int fb_open(const char *device, int flags);
+int fb_ioctl(int fd, unsigned long request, void *arg);
+void *fb_mmap(size_t length, int fd);
+int fb_munmap(void *addr, size_t length);
+int fb_close(int fd);
+
+int fbsim_active(void);
+uint64_t fbsim_clock_ns(void);
+/* Let the virtual clock run until NS, as sleeping would on a device */
+void fbsim_sleep_until(uint64_t ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FBSIM_H */
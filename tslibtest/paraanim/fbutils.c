@@ -28,29 +28,89 @@
 
 #include "font.h"
 #include "fbutils.h"
-
-union multiptr {
-	unsigned char *p8;
-	unsigned short *p16;
-	unsigned long *p32;
-};
+#include "raster.h"
+#include "damage.h"
+#include "epd.h"
+#include "fbsim.h"
+#include "glyph.h"
+#include "psf.h"
 
 static int con_fd, fb_fd, last_vt = -1;
 static struct fb_fix_screeninfo fix;
 static struct fb_var_screeninfo var;
 static unsigned char *fbuffer;
 static unsigned char **line_addr;
+static unsigned char **fb_line_addr;
+static unsigned char *shadow;
 static int fb_fd=0;
-static int bytes_per_pixel;
+static const struct raster_ops *raster_copy, *raster_xor;
 static unsigned colormap [256];
 static const struct fbcon_font_desc * current_font = &font_vga_8x8;
 __u32 xres, yres;
 
+/* Drawing is limited to this rectangle (inclusive), the whole screen
+ * unless set_clip() says otherwise */
+static int clip_x1, clip_y1, clip_x2 = -1, clip_y2 = -1;
+
+/* Page flipping (see open_pages()): the page on the panel, the marker
+ * of the last update sent from each page, and the regions the hidden
+ * page has not been brought up to date with yet */
+static int pages, front;
+static __u32 page_marker [2];
+static struct fb_rect stale [DAMAGE_MAX_REGIONS];
+static int nr_stale;
+
+/* Update source buffers (see alloc_update_buffer()), by offset into the
+ * framebuffer memory, and the one drawn into instead of the screen */
+#define MAX_UPDATE_BUFFERS 8
+
+struct fb_buffer {
+	unsigned char **rows;
+	size_t offset, size;
+	int w, h;
+};
+
+static struct fb_buffer *buffers [MAX_UPDATE_BUFFERS];
+static int nr_buffers;
+static struct fb_buffer *target;
+static unsigned char **screen_line_addr;
+/* Set once the driver has refused an update from a buffer */
+static int no_alt;
+
+static void __pixel (int x, int y, unsigned colidx);
+
 static char *defaultfbdevice = "/dev/fb0";
 static char *defaultconsoledevice = "/dev/tty";
 static char *fbdevice = NULL;
 static char *consoledevice = NULL;
 
+/* Damage coalescing parameters from TSLIB_DAMAGE, a comma separated
+ * list of key=value pairs (see struct damage_params):
+ *
+ *   regions   regions kept before forced merging
+ *   align     x and width are rounded to this many pixels
+ *   cost      fixed cost of one update, in pixels
+ */
+static void parse_damage_params(const char *s)
+{
+	struct damage_params p;
+	char key [16];
+	int value, n;
+
+	damage_get_params (&p);
+	while (s && sscanf (s, "%15[a-z]=%d%n", key, &value, &n) == 2) {
+		if (!strcmp (key, "regions")) p.max_regions = value;
+		else if (!strcmp (key, "align")) p.align = value;
+		else if (!strcmp (key, "cost")) p.update_cost = value;
+		else fprintf (stderr, "TSLIB_DAMAGE: unknown key %s\n", key);
+		s += n;
+		if (*s != ',')
+			break;
+		s++;
+	}
+	damage_set_params (&p);
+}
+
 int open_framebuffer(void)
 {
 	struct vt_stat vts;
@@ -64,6 +124,10 @@ int open_framebuffer(void)
 	if ((consoledevice = getenv ("TSLIB_CONSOLEDEVICE")) == NULL)
 		consoledevice = defaultconsoledevice;
 
+	/* The simulator has no console to switch */
+	if (strncmp (fbdevice, "sim:", 4) == 0)
+		consoledevice = "none";
+
 	if (strcmp (consoledevice, "none") != 0) {
 		sprintf (vtname,"%s%d", consoledevice, 1);
         	fd = open (vtname, O_WRONLY);
@@ -111,47 +175,368 @@ int open_framebuffer(void)
 
 	}
 
-	fb_fd = open(fbdevice, O_RDWR);
+	fb_fd = fb_open(fbdevice, O_RDWR);
 	if (fb_fd == -1) {
 		perror("open fbdevice");
 		return -1;
 	}
 
-	if (ioctl(fb_fd, FBIOGET_FSCREENINFO, &fix) < 0) {
+	if (fb_ioctl(fb_fd, FBIOGET_FSCREENINFO, &fix) < 0) {
 		perror("ioctl FBIOGET_FSCREENINFO");
-		close(fb_fd);
+		fb_close(fb_fd);
 		return -1;
 	}
 
-	if (ioctl(fb_fd, FBIOGET_VSCREENINFO, &var) < 0) {
+	if (fb_ioctl(fb_fd, FBIOGET_VSCREENINFO, &var) < 0) {
 		perror("ioctl FBIOGET_VSCREENINFO");
-		close(fb_fd);
+		fb_close(fb_fd);
 		return -1;
 	}
 	xres = var.xres;
 	yres = var.yres;
 
-	fbuffer = mmap(NULL, fix.smem_len, PROT_READ | PROT_WRITE, MAP_FILE | MAP_SHARED, fb_fd, 0);
+	fbuffer = fb_mmap(fix.smem_len, fb_fd);
 	if (fbuffer == (unsigned char *)-1) {
 		perror("mmap framebuffer");
-		close(fb_fd);
+		fb_close(fb_fd);
 		return -1;
 	}
 	memset(fbuffer,0,fix.smem_len);
 
-	bytes_per_pixel = (var.bits_per_pixel + 7) / 8;
-	line_addr = malloc (sizeof (__u32) * var.yres_virtual);
+	raster_copy = raster_select (var.bits_per_pixel, 0);
+	raster_xor = raster_select (var.bits_per_pixel, 1);
+	line_addr = malloc (sizeof (*line_addr) * var.yres_virtual);
 	addr = 0;
 	for (y = 0; y < var.yres_virtual; y++, addr += fix.line_length)
 		line_addr [y] = fbuffer + addr;
+	fb_line_addr = line_addr;
+	set_clip (NULL);
+	damage_init (xres, yres);
+	parse_damage_params (getenv ("TSLIB_DAMAGE"));
+	epd_init (fb_fd);
+
+	return 0;
+}
 
+/* Redirect all drawing into a copy of the framebuffer in ordinary cached
+ * memory.  Nothing reaches the screen until flush_screen() copies the
+ * dirty rectangles over; XOR drawing reads back from RAM as well.
+ */
+int open_shadow(void)
+{
+	unsigned y;
+
+	if (shadow)
+		return 0;
+	if (target)
+		return -1;
+
+	shadow = malloc (fix.line_length * yres);
+	line_addr = malloc (sizeof (*line_addr) * yres);
+	if (shadow == NULL || line_addr == NULL) {
+		perror("malloc shadow");
+		free (shadow);
+		free (line_addr);
+		shadow = NULL;
+		line_addr = fb_line_addr + (pages ? !front : front) * yres;
+		return -1;
+	}
+
+	for (y = 0; y < yres; y++) {
+		line_addr [y] = shadow + y * fix.line_length;
+		memcpy (line_addr [y], fb_line_addr [front * yres + y],
+			fix.line_length);
+	}
+
+	return 0;
+}
+
+static int pan (int page)
+{
+	var.xoffset = 0;
+	var.yoffset = page * yres;
+	if (fb_ioctl (fb_fd, FBIOPAN_DISPLAY, &var) < 0)
+		return -1;
+	front = page;
 	return 0;
 }
 
+/* Bytes from the start of a row to the end of pixel W - 1, which for
+ * the packed formats below 8 bpp is less than W */
+static size_t row_bytes (int w)
+{
+	return ((size_t)w * var.bits_per_pixel + 7) / 8;
+}
+
+/* Bytes between the rows of the surface drawn on: an update buffer's
+ * rows are packed, the others are framebuffer lines */
+static size_t line_pitch (void)
+{
+	return target ? row_bytes (target->w) : fix.line_length;
+}
+
+/* Copy the regions R[0..N-1] from the rows FROM to the rows TO */
+static void copy_regions (unsigned char **to, unsigned char **from,
+			  const struct fb_rect *r, int n)
+{
+	int i, y;
+
+	for (i = 0; i < n; i++)
+		for (y = r [i].y; y < r [i].y + r [i].h; y++)
+			raster_copy->copy (to [y], r [i].x, from [y], r [i].x,
+					   r [i].w);
+}
+
+/* Double buffer through a second page below the visible one, which the
+ * EPDC driver reserves anyway (yres_virtual >= 2 * yres).  Frames are
+ * completed in the hidden page, straight or from the shadow buffer, and
+ * flush_screen() pans to it before sending the updates, so the panel
+ * never picks up a half-drawn frame and the page on it is not written
+ * until its updates are done.  Returns -1 if there is no second page or
+ * the driver cannot pan; flush_screen() then copies as before.
+ */
+int open_pages(void)
+{
+	unsigned y;
+
+	int i;
+
+	if (pages)
+		return 0;
+	if (var.yres_virtual < 2 * yres || target)
+		return -1;
+	for (i = 0; i < nr_buffers; i++)
+		if (buffers [i]->offset < 2 * yres * fix.line_length)
+			return -1;
+	if (pan (front) < 0)
+		return -1;
+
+	for (y = 0; y < yres; y++)
+		memcpy (fb_line_addr [(!front) * yres + y],
+			fb_line_addr [front * yres + y], fix.line_length);
+	page_marker [0] = page_marker [1] = 0;
+	nr_stale = 0;
+	pages = 1;
+	if (!shadow)
+		line_addr = fb_line_addr + (!front) * yres;
+	return 0;
+}
+
+/* Go back to copying into the page on the panel */
+void close_pages(void)
+{
+	unsigned y;
+
+	if (!pages)
+		return;
+	pages = 0;
+	if (shadow)
+		return;
+	/* what has been drawn since the last flip is only in the hidden
+	 * page */
+	for (y = 0; y < yres; y++)
+		memcpy (fb_line_addr [front * yres + y], line_addr [y],
+			fix.line_length);
+	line_addr = fb_line_addr + front * yres;
+}
+
+/* Framebuffer memory the EPDC can read from without it being on the
+ * panel: everything after the visible page, or both pages while they
+ * are flipped.  Buffers are taken from the end, which leaves the second
+ * page free as long as there is room beyond it.
+ */
+/* Offset for SIZE bytes ending at END at the latest and starting at
+ * BOTTOM at the earliest: on a cache line if that fits, else exactly
+ * at END - SIZE; (size_t)-1 if they do not fit at all */
+static size_t place_buffer(size_t bottom, size_t end, size_t size)
+{
+	size_t offset;
+
+	if (end < bottom || end - bottom < size)
+		return (size_t)-1;
+	offset = (end - size) & ~(size_t)63;
+	return offset >= bottom ? offset : end - size;
+}
+
+struct fb_buffer *alloc_update_buffer(int w, int h)
+{
+	struct fb_buffer *b;
+	size_t size, start, end, offset;
+	int i, y;
+
+	if (w <= 0 || h <= 0 || nr_buffers == MAX_UPDATE_BUFFERS)
+		return NULL;
+	/* rows are packed, the way the driver reads them; the start is
+	 * kept on a cache line where there is room for it */
+	size = row_bytes (w) * h;
+	start = (pages ? 2 : 1) * yres * fix.line_length;
+
+	/* buffers [] is sorted by offset, highest first */
+	end = fix.smem_len;
+	offset = (size_t)-1;
+	for (i = 0; i < nr_buffers; i++) {
+		offset = place_buffer (buffers [i]->offset + buffers [i]->size,
+				       end, size);
+		if (offset != (size_t)-1)
+			break;
+		end = buffers [i]->offset;
+	}
+	if (i == nr_buffers)
+		offset = place_buffer (start, end, size);
+	if (offset == (size_t)-1)
+		return NULL;
+
+	b = malloc (sizeof (*b));
+	if (b == NULL)
+		return NULL;
+	b->rows = malloc (sizeof (*b->rows) * h);
+	if (b->rows == NULL) {
+		free (b);
+		return NULL;
+	}
+	b->offset = offset;
+	b->size = size;
+	b->w = w;
+	b->h = h;
+	for (y = 0; y < h; y++)
+		b->rows [y] = fbuffer + b->offset + y * row_bytes (w);
+
+	memmove (&buffers [i + 1], &buffers [i],
+		 (nr_buffers - i) * sizeof (*buffers));
+	buffers [i] = b;
+	nr_buffers++;
+	return b;
+}
+
+void free_update_buffer(struct fb_buffer *b)
+{
+	int i;
+
+	if (b == NULL)
+		return;
+	if (b == target)
+		draw_to_buffer (NULL);
+	for (i = 0; i < nr_buffers && buffers [i] != b; i++)
+		;
+	if (i < nr_buffers) {
+		memmove (&buffers [i], &buffers [i + 1],
+			 (nr_buffers - i - 1) * sizeof (*buffers));
+		nr_buffers--;
+	}
+	free (b->rows);
+	free (b);
+}
+
+/* Copy the picture between the drawing surface and B where they overlap;
+ * coming back, the page on the panel gets it too, as it never saw what
+ * was sent from B */
+static void swap_surface (struct fb_buffer *b, int to_buffer)
+{
+	unsigned char **visible = fb_line_addr + front * yres;
+	int w = b->w < (int)xres ? b->w : (int)xres;
+	int h = b->h < (int)yres ? b->h : (int)yres;
+	int y;
+
+	for (y = 0; y < h; y++) {
+		if (to_buffer) {
+			raster_copy->copy (b->rows [y], 0, line_addr [y], 0, w);
+			continue;
+		}
+		raster_copy->copy (screen_line_addr [y], 0, b->rows [y], 0, w);
+		if (shadow)
+			raster_copy->copy (visible [y], 0, b->rows [y], 0, w);
+	}
+}
+
+/* Draw into B, placed at the top left of the screen, instead of the
+ * shadow buffer or framebuffer; B takes over the current picture first.
+ * flush_screen() then has the dirty regions updated straight from B.
+ * NULL goes back to drawing on the screen, taking the picture in B
+ * along.  Not possible while pages are flipped.
+ */
+int draw_to_buffer(struct fb_buffer *b)
+{
+	if (b == target)
+		return 0;
+	if (pages)
+		return -1;
+	if (target) {
+		swap_surface (target, 0);
+		line_addr = screen_line_addr;
+		target = NULL;
+	}
+	if (b) {
+		swap_surface (b, 1);
+		screen_line_addr = line_addr;
+		line_addr = b->rows;
+		target = b;
+	}
+	set_clip (NULL);
+	return 0;
+}
+
+/* Copy W x H pixels at SX, SY in B to X, Y on the page on the panel */
+static void copy_out (const struct fb_buffer *b, int sx, int sy,
+		      int x, int y, int w, int h)
+{
+	unsigned char **visible = fb_line_addr + front * yres;
+	int i;
+
+	for (i = 0; i < h; i++)
+		raster_copy->copy (visible [y + i], x, b->rows [sy + i], sx, w);
+}
+
+/* Update the screen area at X, Y from the area SRC of B, which must lie
+ * inside both.  The EPDC reads the pixels straight from B unless the
+ * driver cannot do that or MODE has MXC_DAMAGE_MODE_COPY; then they are
+ * copied to the framebuffer first.  Either way neither the framebuffer
+ * nor the shadow buffer keep them: an update from there that covers the
+ * area puts back what they hold.  Returns the marker of the update.
+ */
+__u32 push_buffer(const struct fb_buffer *b, const struct fb_rect *src,
+		  int x, int y, int mode)
+{
+	struct epd_source alt;
+	__u32 marker;
+
+	if (!no_alt && !(mode & MXC_DAMAGE_MODE_COPY)) {
+		alt.phys = fix.smem_start + b->offset;
+		alt.width = b->w;
+		alt.height = b->h;
+		alt.x = src->x;
+		alt.y = src->y;
+		marker = epd_submit_alt (x, y, src->w, src->h, mode, &alt);
+		if (marker)
+			return marker;
+		fprintf (stderr, "no updates from alternate buffers, copying\n");
+		no_alt = 1;
+	}
+	copy_out (b, src->x, src->y, x, y, src->w, src->h);
+	return mxc_damage (x, y, src->w, src->h, mode, 0);
+}
+
 void close_framebuffer(void)
 {
-	munmap(fbuffer, fix.smem_len);
-	close(fb_fd);
+	unsigned y;
+
+	if (target) {
+		line_addr = screen_line_addr;
+		target = NULL;
+	}
+	while (nr_buffers)
+		free_update_buffer (buffers [0]);
+
+	/* leave the screen in the first page for whoever comes next */
+	if (front != 0) {
+		for (y = 0; y < yres; y++)
+			memcpy (fb_line_addr [y], fb_line_addr [yres + y],
+				fix.line_length);
+		pan (0);
+	}
+	pages = 0;
+	epd_exit();
+	fb_munmap(fbuffer, fix.smem_len);
+	fb_close(fb_fd);
 
 
 	if(strcmp(consoledevice,"none")!=0) {
@@ -166,7 +551,139 @@ void close_framebuffer(void)
         	close(con_fd);
 	}
 
-        free (line_addr);
+	if (shadow) {
+		free (line_addr);
+		free (shadow);
+		shadow = NULL;
+	}
+        free (fb_line_addr);
+}
+
+/* Record that the screen area x1..x2, y1..y2 (inclusive) was drawn to */
+static inline void mark_dirty (int x1, int y1, int x2, int y2)
+{
+	if (x1 < clip_x1) x1 = clip_x1;
+	if (y1 < clip_y1) y1 = clip_y1;
+	if (x2 > clip_x2) x2 = clip_x2;
+	if (y2 > clip_y2) y2 = clip_y2;
+	damage_add (x1, y1, x2, y2);
+}
+
+/* Restrict all drawing, and the damage it records, to R; NULL lifts the
+ * restriction again */
+void set_clip (const struct fb_rect *r)
+{
+	clip_x1 = 0;
+	clip_y1 = 0;
+	clip_x2 = xres - 1;
+	clip_y2 = yres - 1;
+	if (target && target->w < (int)xres) clip_x2 = target->w - 1;
+	if (target && target->h < (int)yres) clip_y2 = target->h - 1;
+	if (r == NULL)
+		return;
+	if (r->x > clip_x1) clip_x1 = r->x;
+	if (r->y > clip_y1) clip_y1 = r->y;
+	if (r->x + r->w - 1 < clip_x2) clip_x2 = r->x + r->w - 1;
+	if (r->y + r->h - 1 < clip_y2) clip_y2 = r->y + r->h - 1;
+}
+
+/* raster_clip_line() against the clip rectangle instead of the screen */
+static int clip_line (int x1, int y1, int x2, int y2, int skip_first,
+		      struct raster_line *l)
+{
+	if (!raster_clip_line (x1 - clip_x1, y1 - clip_y1, x2 - clip_x1,
+			       y2 - clip_y1, clip_x2 - clip_x1 + 1,
+			       clip_y2 - clip_y1 + 1, skip_first, l))
+		return 0;
+	l->x += clip_x1;
+	l->y += clip_y1;
+	return 1;
+}
+
+/* Flip to the hidden page, which already holds the new frame (or gets
+ * it from the shadow buffer first), and send the updates from there.
+ * The page that was on the panel becomes the hidden one and has to
+ * catch up with what changed once its own updates are through.  If the
+ * driver refuses to pan, page flipping is given up and -1 returned.
+ */
+static int flip (const struct fb_rect *dirty, int nr_dirty, int mode,
+		 __u32 *markers)
+{
+	unsigned char **back = fb_line_addr + (!front) * yres;
+	int i;
+
+	if (shadow) {
+		epd_wait (page_marker [!front]);
+		copy_regions (back, line_addr, stale, nr_stale);
+		copy_regions (back, line_addr, dirty, nr_dirty);
+	}
+	if (pan (!front) < 0) {
+		perror ("ioctl FBIOPAN_DISPLAY");
+		pages = 0;
+		if (!shadow) {
+			line_addr = fb_line_addr + front * yres;
+			copy_regions (line_addr, back, dirty, nr_dirty);
+		}
+		return -1;
+	}
+	for (i = 0; i < nr_dirty; i++)
+		markers [i] = mxc_damage (dirty [i].x, dirty [i].y, dirty [i].w,
+					  dirty [i].h, mode, 0);
+	page_marker [front] = markers [nr_dirty - 1];
+
+	back = fb_line_addr + (!front) * yres;
+	if (shadow) {
+		memcpy (stale, dirty, nr_dirty * sizeof (*dirty));
+		nr_stale = nr_dirty;
+	} else {
+		epd_wait (page_marker [!front]);
+		copy_regions (back, fb_line_addr + front * yres, dirty, nr_dirty);
+		line_addr = back;
+	}
+	return 0;
+}
+
+/* Push everything drawn since the last flush to the panel: copy the
+ * coalesced dirty regions out of the shadow buffer, if there is one, and
+ * send an EPD update for each of them, or flip pages (see open_pages()),
+ * or update them from the buffer drawn into (see draw_to_buffer()).
+ * With WAIT set, returns once all of them have completed.  Returns the
+ * marker of the last update, or 0 if there was nothing to flush.
+ */
+__u32 flush_screen(int mode, int wait)
+{
+	struct fb_rect dirty [DAMAGE_MAX_REGIONS], *r;
+	__u32 markers [DAMAGE_MAX_REGIONS];
+	unsigned char **visible;
+	int i, y, nr_dirty;
+
+	nr_dirty = damage_collect (dirty);
+	if (target) {
+		for (i = 0; i < nr_dirty; i++) {
+			/* regions are rounded out, maybe past a narrow buffer */
+			r = &dirty [i];
+			if (r->x + r->w > target->w)
+				r->w = target->w - r->x;
+			if (r->y + r->h > target->h)
+				r->h = target->h - r->y;
+			markers [i] = push_buffer (target, r, r->x, r->y, mode);
+		}
+	} else if (!nr_dirty || !pages || flip (dirty, nr_dirty, mode, markers) < 0) {
+		visible = fb_line_addr + front * yres;
+		for (i = 0; i < nr_dirty; i++) {
+			r = &dirty [i];
+			if (shadow)
+				for (y = r->y; y < r->y + r->h; y++)
+					raster_copy->copy (visible [y], r->x,
+							   line_addr [y], r->x, r->w);
+			markers [i] = mxc_damage (r->x, r->y, r->w, r->h, mode, 0);
+		}
+	}
+	if (wait)
+		for (i = 0; i < nr_dirty; i++)
+			epd_wait (markers [i]);
+
+	return nr_dirty ? markers [nr_dirty - 1] : 0;
 }
 
 void put_cross(int x, int y, unsigned colidx)
@@ -199,32 +716,166 @@ void setfont(const struct fbcon_font_desc *font)
 		current_font = font;
 }
 
+/* Text is drawn from the glyph cache: a transparent glyph is a handful
+ * of span fills, an opaque one a row copy per scan line.  The bit by bit
+ * loop is only left as a fallback for when the cache cannot allocate.
+ */
 void put_char(int x, int y, int c, int colidx)
 {
-	int i,j,bits;
+	const struct glyph *g;
+	const struct glyph_run *run;
+	const struct raster_ops *ops;
+	const unsigned char *bits;
+	unsigned color;
+	int i, j, pitch, row, x1, x2;
+
+	c = font_glyph (current_font, c);
+	g = glyph_runs (current_font, c);
+	if (g == NULL) {
+		pitch = (current_font->width + 7) / 8;
+		bits = (const unsigned char *)current_font->data +
+			c * current_font->height * pitch;
+		for (i = 0; i < current_font->height; i++, bits += pitch)
+			for (j = 0; j < current_font->width; j++)
+				if (bits [j >> 3] & (0x80 >> (j & 7)))
+					__pixel (x + j, y + i, colidx);
+	} else {
+		ops = (colidx & XORMODE) ? raster_xor : raster_copy;
+		color = colormap [colidx & ~XORMODE];
+		for (i = 0, run = g->runs; i < g->nr_runs; i++, run++) {
+			row = y + run->row;
+			x1 = x + run->x;
+			x2 = x1 + run->len - 1;
+			if (row < clip_y1 || row > clip_y2 || x2 < clip_x1 || x1 > clip_x2)
+				continue;
+			if (x1 < clip_x1) x1 = clip_x1;
+			if (x2 > clip_x2) x2 = clip_x2;
+			ops->hspan (line_addr [row], x1, x2 - x1 + 1, color);
+		}
+	}
+	mark_dirty (x, y, x + current_font->width - 1,
+		    y + current_font->height - 1);
+}
+
+/* Draw glyph C with its background in one pass */
+void put_char_opaque(int x, int y, int c, unsigned colidx, unsigned bgidx)
+{
+	const unsigned char *img;
+	int i, pitch, x1, x2;
+
+	img = glyph_image (current_font, font_glyph (current_font, c),
+			   colormap [colidx], colormap [bgidx],
+			   var.bits_per_pixel);
+	if (img == NULL) {
+		fillrect (x, y, x + current_font->width - 1,
+			  y + current_font->height - 1, bgidx);
+		put_char (x, y, c, colidx);
+		return;
+	}
+
+	x1 = x;
+	x2 = x + current_font->width - 1;
+	if (x2 < clip_x1 || x1 > clip_x2)
+		return;
+	if (x1 < clip_x1) x1 = clip_x1;
+	if (x2 > clip_x2) x2 = clip_x2;
+
+	pitch = row_bytes (current_font->width);
+	for (i = 0; i < current_font->height; i++, img += pitch) {
+		if (y + i < clip_y1 || y + i > clip_y2)
+			continue;
+		raster_copy->copy (line_addr [y + i], x1, img, x1 - x,
+				   x2 - x1 + 1);
+	}
+	mark_dirty (x, y, x + current_font->width - 1,
+		    y + current_font->height - 1);
+}
 
-	for (i = 0; i < current_font->height; i++) {
-		bits = current_font->data [current_font->height * c + i];
-		for (j = 0; j < current_font->width; j++, bits <<= 1)
-			if (bits & 0x80)
-				pixel (x + j, y + i, colidx);
+/* Next character of S: strings are UTF-8 for fonts with a Unicode
+ * table and plain bytes otherwise */
+static unsigned next_char(const char **s)
+{
+	const unsigned char *p = (const unsigned char *)*s;
+	unsigned c = *p++;
+	int n = 0;
+
+	if (current_font->map != NULL && c >= 0xc0) {
+		if (c < 0xe0) { n = 1; c &= 0x1f; }
+		else if (c < 0xf0) { n = 2; c &= 0x0f; }
+		else { n = 3; c &= 0x07; }
+		for (; n > 0 && (*p & 0xc0) == 0x80; n--)
+			c = c << 6 | (*p++ & 0x3f);
+		if (n > 0)
+			c = '?';
 	}
+	*s = (const char *)p;
+	return c;
 }
 
 void put_string(int x, int y, char *s, unsigned colidx)
 {
-	int i;
-	for (i = 0; *s; i++, x += current_font->width, s++)
-		put_char (x, y, *s, colidx);
+	const char *p = s;
+
+	for (; *p; x += current_font->width)
+		put_char (x, y, next_char (&p), colidx);
+}
+
+void put_string_opaque(int x, int y, char *s, unsigned colidx, unsigned bgidx)
+{
+	const char *p = s;
+
+	for (; *p; x += current_font->width)
+		put_char_opaque (x, y, next_char (&p), colidx, bgidx);
 }
 
 void put_string_center(int x, int y, char *s, unsigned colidx)
 {
-	size_t sl = strlen (s);
+	const char *p = s;
+	size_t sl = 0;
+
+	for (; *p; sl++)
+		next_char (&p);
         put_string (x - (sl / 2) * current_font->width,
                     y - current_font->height / 2, s, colidx);
 }
 
+/* Fill the box X1, Y1 - X2, Y2 with BGIDX and centre S in it, drawn
+ * with its background in one pass: only the bands around the text are
+ * filled.  Text that does not fit is cut off at the box. */
+void put_string_box(int x1, int y1, int x2, int y2, char *s,
+		    unsigned colidx, unsigned bgidx)
+{
+	int cx1 = clip_x1, cy1 = clip_y1, cx2 = clip_x2, cy2 = clip_y2;
+	const char *p = s;
+	int n, tx, ty, tx2, ty2;
+
+	for (n = 0; *p; n++)
+		next_char (&p);
+	tx = x1 + (x2 - x1 + 1) / 2 - (n / 2) * current_font->width;
+	ty = y1 + (y2 - y1 + 1) / 2 - current_font->height / 2;
+	tx2 = tx + n * current_font->width - 1;
+	ty2 = ty + current_font->height - 1;
+
+	if (x1 > clip_x1) clip_x1 = x1;
+	if (y1 > clip_y1) clip_y1 = y1;
+	if (x2 < clip_x2) clip_x2 = x2;
+	if (y2 < clip_y2) clip_y2 = y2;
+	if (ty > y1)
+		fillrect (x1, y1, x2, ty - 1, bgidx);
+	if (ty2 < y2)
+		fillrect (x1, ty2 + 1, x2, y2, bgidx);
+	if (tx > x1)
+		fillrect (x1, ty, tx - 1, ty2, bgidx);
+	if (tx2 < x2)
+		fillrect (tx2 + 1, ty, x2, ty2, bgidx);
+	put_string_opaque (tx, ty, s, colidx, bgidx);
+
+	clip_x1 = cx1;
+	clip_y1 = cy1;
+	clip_x2 = cx2;
+	clip_y2 = cy2;
+}
+
 void setcolor(unsigned colidx, unsigned value)
 {
 	unsigned res;
@@ -239,9 +890,19 @@ void setcolor(unsigned colidx, unsigned value)
 	}
 #endif
 
-	switch (bytes_per_pixel) {
-	default:
+	switch (var.bits_per_pixel) {
 	case 1:
+	case 2:
+	case 4:
+		/* packed formats are gray levels, not palette indices */
+		red = (value >> 16) & 0xff;
+		green = (value >> 8) & 0xff;
+		blue = value & 0xff;
+		res = ((red * 77 + green * 150 + blue * 29) >> 8) >>
+		      (8 - var.bits_per_pixel);
+		break;
+	default:
+	case 8:
 		res = colidx;
 		red = (value >> 8) & 0xff00;
 		green = value & 0xff00;
@@ -253,11 +914,11 @@ void setcolor(unsigned colidx, unsigned value)
 		cmap.blue = &blue;
 		cmap.transp = NULL;
 
-        	if (ioctl (fb_fd, FBIOPUTCMAP, &cmap) < 0)
+        	if (fb_ioctl (fb_fd, FBIOPUTCMAP, &cmap) < 0)
         	        perror("ioctl FBIOPUTCMAP");
 		break;
-	case 2:
-	case 4:
+	case 16:
+	case 32:
 		red = (value >> 16) & 0xff;
 		green = (value >> 8) & 0xff;
 		blue = value & 0xff;
@@ -268,41 +929,14 @@ void setcolor(unsigned colidx, unsigned value)
         colormap [colidx] = res;
 }
 
-static inline void __setpixel (union multiptr loc, unsigned xormode, unsigned color)
+static void __pixel (int x, int y, unsigned colidx)
 {
-	switch(bytes_per_pixel) {
-	case 1:
-	default:
-		if (xormode)
-			*loc.p8 ^= color;
-		else
-			*loc.p8 = color;
-		break;
-	case 2:
-		if (xormode)
-			*loc.p16 ^= color;
-		else
-			*loc.p16 = color;
-		break;
-	case 4:
-		if (xormode)
-			*loc.p32 ^= color;
-		else
-			*loc.p32 = color;
-		break;
-	}
-}
-
-void pixel (int x, int y, unsigned colidx)
-{
-	unsigned xormode;
-	union multiptr loc;
+	const struct raster_ops *ops;
 
-	if ((x < 0) || ((__u32)x >= var.xres_virtual) ||
-	    (y < 0) || ((__u32)y >= var.yres_virtual))
+	if (x < clip_x1 || x > clip_x2 || y < clip_y1 || y > clip_y2)
 		return;
 
-	xormode = colidx & XORMODE;
+	ops = (colidx & XORMODE) ? raster_xor : raster_copy;
 	colidx &= ~XORMODE;
 
 #ifdef DEBUG
@@ -313,72 +947,173 @@ void pixel (int x, int y, unsigned colidx)
 	}
 #endif
 
-	loc.p8 = line_addr [y] + x * bytes_per_pixel;
-	__setpixel (loc, xormode, colormap [colidx]);
+	ops->pixel (line_addr [y], x, colormap [colidx]);
 }
 
+void pixel (int x, int y, unsigned colidx)
+{
+	__pixel (x, y, colidx);
+	mark_dirty (x, y, x, y);
+}
+
+/* The segment is clipped to the screen once; the pixels that remain are
+ * plotted by the backend without any further checks.
+ */
 void line (int x1, int y1, int x2, int y2, unsigned colidx)
 {
-	int tmp;
-	int dx = x2 - x1;
-	int dy = y2 - y1;
-
-	if (abs (dx) < abs (dy)) {
-		if (y1 > y2) {
-			tmp = x1; x1 = x2; x2 = tmp;
-			tmp = y1; y1 = y2; y2 = tmp;
-			dx = -dx; dy = -dy;
-		}
-		x1 <<= 16;
-		/* dy is apriori >0 */
-		dx = (dx << 16) / dy;
-		while (y1 <= y2) {
-			pixel (x1 >> 16, y1, colidx);
-			x1 += dx;
-			y1++;
-		}
-	} else {
-		if (x1 > x2) {
-			tmp = x1; x1 = x2; x2 = tmp;
-			tmp = y1; y1 = y2; y2 = tmp;
-			dx = -dx; dy = -dy;
-		}
-		y1 <<= 16;
-		dy = dx ? (dy << 16) / dx : 0;
-		while (x1 <= x2) {
-			pixel (x1, y1 >> 16, colidx);
-			y1 += dy;
-			x1++;
+	struct raster_line l;
+	const struct raster_ops *ops;
+
+	if (!clip_line (x1, y1, x2, y2, 0, &l))
+		return;
+
+	ops = (colidx & XORMODE) ? raster_xor : raster_copy;
+	colidx &= ~XORMODE;
+	ops->line (line_addr, &l, colormap [colidx]);
+	mark_dirty (x1 < x2 ? x1 : x2, y1 < y2 ? y1 : y2,
+		    x1 > x2 ? x1 : x2, y1 > y2 ? y1 : y2);
+}
+
+static void __polyline (const struct point *pts, int n, unsigned colidx,
+			int skip_first, struct fb_rect *bbox)
+{
+	struct raster_line l;
+	const struct raster_ops *ops;
+	int i, x1, y1, x2, y2;
+
+	if (bbox)
+		bbox->x = bbox->y = bbox->w = bbox->h = 0;
+	if (n <= 0)
+		return;
+
+	ops = (colidx & XORMODE) ? raster_xor : raster_copy;
+	colidx = colormap [colidx & ~XORMODE];
+
+	x1 = x2 = pts [0].x;
+	y1 = y2 = pts [0].y;
+	if (n == 1 && !skip_first &&
+	    clip_line (x1, y1, x1, y1, 0, &l))
+		ops->line (line_addr, &l, colidx);
+
+	/* Every segment leaves out its first pixel, which is the last pixel
+	 * of the previous one, so joints are plotted once and XOR strokes
+	 * stay reversible. */
+	for (i = 1; i < n; i++) {
+		if (clip_line (pts [i - 1].x, pts [i - 1].y, pts [i].x, pts [i].y,
+			       i > 1 || skip_first, &l))
+			ops->line (line_addr, &l, colidx);
+		if (pts [i].x < x1) x1 = pts [i].x;
+		if (pts [i].x > x2) x2 = pts [i].x;
+		if (pts [i].y < y1) y1 = pts [i].y;
+		if (pts [i].y > y2) y2 = pts [i].y;
+	}
+
+	if (bbox) {
+		if (x1 < clip_x1) x1 = clip_x1;
+		if (y1 < clip_y1) y1 = clip_y1;
+		if (x2 > clip_x2) x2 = clip_x2;
+		if (y2 > clip_y2) y2 = clip_y2;
+		if (x1 <= x2 && y1 <= y2) {
+			bbox->x = x1;
+			bbox->y = y1;
+			bbox->w = x2 - x1 + 1;
+			bbox->h = y2 - y1 + 1;
 		}
 	}
+	mark_dirty (x1, y1, x2, y2);
+}
+
+/* Draw the open polyline through N vertices with one setup.  The screen
+ * area covered by the stroke is stored in BBOX if it is not NULL.
+ */
+void polyline (const struct point *pts, int n, unsigned colidx,
+	       struct fb_rect *bbox)
+{
+	__polyline (pts, n, colidx, 0, bbox);
+}
+
+/* Same as polyline(), for extending a stroke whose first vertex pts[0]
+ * has already been drawn.
+ */
+void polyline_continue (const struct point *pts, int n, unsigned colidx,
+			struct fb_rect *bbox)
+{
+	__polyline (pts, n, colidx, 1, bbox);
+}
+
+void hline (int x1, int x2, int y, unsigned colidx)
+{
+	int tmp;
+	const struct raster_ops *ops;
+
+	if (x1 > x2) { tmp = x1; x1 = x2; x2 = tmp; }
+	if (y < clip_y1 || y > clip_y2 || x2 < clip_x1 || x1 > clip_x2)
+		return;
+	if (x1 < clip_x1) x1 = clip_x1;
+	if (x2 > clip_x2) x2 = clip_x2;
+
+	ops = (colidx & XORMODE) ? raster_xor : raster_copy;
+	colidx &= ~XORMODE;
+	ops->hspan (line_addr [y], x1, x2 - x1 + 1, colormap [colidx]);
+	mark_dirty (x1, y, x2, y);
+}
+
+void vline (int x, int y1, int y2, unsigned colidx)
+{
+	int tmp;
+	const struct raster_ops *ops;
+
+	if (y1 > y2) { tmp = y1; y1 = y2; y2 = tmp; }
+	if (x < clip_x1 || x > clip_x2 || y2 < clip_y1 || y1 > clip_y2)
+		return;
+	if (y1 < clip_y1) y1 = clip_y1;
+	if (y2 > clip_y2) y2 = clip_y2;
+
+	ops = (colidx & XORMODE) ? raster_xor : raster_copy;
+	colidx &= ~XORMODE;
+	ops->vspan (line_addr [y1], line_pitch (), x, y2 - y1 + 1,
+		    colormap [colidx]);
+	mark_dirty (x, y1, x, y2);
 }
 
+/* Each pixel of the outline is touched exactly once, so drawing the
+ * same rectangle twice in XOR mode restores the background corners too.
+ */
 void rect (int x1, int y1, int x2, int y2, unsigned colidx)
 {
-	line (x1, y1, x2, y1, colidx);
-	line (x2, y1, x2, y2, colidx);
-	line (x2, y2, x1, y2, colidx);
-	line (x1, y2, x1, y1, colidx);
+	int tmp;
+
+	if (x1 > x2) { tmp = x1; x1 = x2; x2 = tmp; }
+	if (y1 > y2) { tmp = y1; y1 = y2; y2 = tmp; }
+
+	hline (x1, x2, y1, colidx);
+	if (y2 == y1)
+		return;
+	hline (x1, x2, y2, colidx);
+	if (y2 - y1 < 2)
+		return;
+	vline (x1, y1 + 1, y2 - 1, colidx);
+	if (x2 != x1)
+		vline (x2, y1 + 1, y2 - 1, colidx);
 }
 
 void fillrect (int x1, int y1, int x2, int y2, unsigned colidx)
 {
 	int tmp;
-	unsigned xormode;
-	union multiptr loc;
+	const struct raster_ops *ops;
 
 	/* Clipping and sanity checking */
 	if (x1 > x2) { tmp = x1; x1 = x2; x2 = tmp; }
 	if (y1 > y2) { tmp = y1; y1 = y2; y2 = tmp; }
-	if (x1 < 0) x1 = 0; if ((__u32)x1 >= xres) x1 = xres - 1;
-	if (x2 < 0) x2 = 0; if ((__u32)x2 >= xres) x2 = xres - 1;
-	if (y1 < 0) y1 = 0; if ((__u32)y1 >= yres) y1 = yres - 1;
-	if (y2 < 0) y2 = 0; if ((__u32)y2 >= yres) y2 = yres - 1;
+	if (x1 < clip_x1) x1 = clip_x1;
+	if (x2 > clip_x2) x2 = clip_x2;
+	if (y1 < clip_y1) y1 = clip_y1;
+	if (y2 > clip_y2) y2 = clip_y2;
 
 	if ((x1 > x2) || (y1 > y2))
 		return;
 
-	xormode = colidx & XORMODE;
+	ops = (colidx & XORMODE) ? raster_xor : raster_copy;
 	colidx &= ~XORMODE;
 
 #ifdef DEBUG
@@ -391,62 +1126,75 @@ void fillrect (int x1, int y1, int x2, int y2, unsigned colidx)
 
 	colidx = colormap [colidx];
 
-	for (; y1 <= y2; y1++) {
-		loc.p8 = line_addr [y1] + x1 * bytes_per_pixel;
-		for (tmp = x1; tmp <= x2; tmp++) {
-			__setpixel (loc, xormode, colidx);
-			loc.p8 += bytes_per_pixel;
-		}
-	}
+	mark_dirty (x1, y1, x2, y2);
+	for (; y1 <= y2; y1++)
+		ops->hspan (line_addr [y1], x1, x2 - x1 + 1, colidx);
 }
 
-/*** EPD ***/
+/* Pixel J of a packed row, most significant bits first */
+static inline int bitmap_get (const unsigned char *row, int j, int depth)
+{
+	if (depth == 1)
+		return (row [j >> 3] >> (7 - (j & 7))) & 1;
+	return (row [j >> 1] >> ((j & 1) ? 0 : 4)) & 15;
+}
 
-static int64_t current_msec(void)
+void put_bitmap (int x, int y, int w, int h, const unsigned char *data,
+		 int pitch, int depth, const unsigned *palette)
 {
-    struct timeval tv;
+	const unsigned char *row;
+	int x1, y1, x2, y2, j, start, end, c, v;
+
+	x1 = x < clip_x1 ? clip_x1 : x;
+	y1 = y < clip_y1 ? clip_y1 : y;
+	x2 = x + w - 1 > clip_x2 ? clip_x2 : x + w - 1;
+	y2 = y + h - 1 > clip_y2 ? clip_y2 : y + h - 1;
+	if (x1 > x2 || y1 > y2)
+		return;
 
-    gettimeofday(&tv, NULL);
-    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	/* runs of one value go out as a single span */
+	for (j = y1; j <= y2; j++) {
+		row = data + (j - y) * pitch;
+		start = x1 - x;
+		end = x2 - x;
+		c = bitmap_get (row, start, depth);
+		for (v = start + 1; v <= end; v++) {
+			/* whole bytes of background or ink */
+			if (depth == 1 && !(v & 7) && end - v >= 8 &&
+			    row [v >> 3] == (c ? 0xff : 0)) {
+				v += 7;
+				continue;
+			}
+			if (bitmap_get (row, v, depth) == c)
+				continue;
+			raster_copy->hspan (line_addr [j], x + start, v - start,
+					    colormap [palette [c]]);
+			start = v;
+			c = bitmap_get (row, v, depth);
+		}
+		raster_copy->hspan (line_addr [j], x + start, end - start + 1,
+				    colormap [palette [c]]);
+	}
+	mark_dirty (x1, y1, x2, y2);
 }
 
-void mxc_damage(int x, int y, int w, int h, int mode, int wait)
+/*** EPD ***/
+
+/* Send an update for the given area and return its marker.  With WAIT
+ * set, returns once the update has completed.  Updates are recorded in
+ * the trace ring (see trace.h) rather than logged.
+ */
+__u32 mxc_damage(int x, int y, int w, int h, int mode, int wait)
 {
-	struct mxcfb_update_data param;
-        
-	const int MARKER = 999;
-	int r;
+	epd_marker_t marker;
 
 	if (fb_fd < 0) {
-		return;
+		return 0;
 	}
 
-	int64_t start_time = current_msec();
-
-	param.update_region.left = x;
-	param.update_region.top = y;
-	param.update_region.width = w;
-	param.update_region.height = h;
-	if (mode & MXC_DAMAGE_MODE_FULL)
-		param.update_mode = UPDATE_MODE_FULL;
-	else
-		param.update_mode = UPDATE_MODE_PARTIAL;
-	param.update_marker = MARKER;
-	param.temp = 0;
-	if (mode & MXC_DAMAGE_MODE_MONOCHROME) {
-		param.waveform_mode = 4;
-		param.flags = EPDC_FLAG_FORCE_MONOCHROME;
-	} else {
-		param.waveform_mode = WAVEFORM_MODE_AUTO;
-		param.flags = 0;
-	}
+	marker = epd_submit(x, y, w, h, mode);
+	if (wait)
+		epd_wait(marker);
 
-	r = ioctl(fb_fd, MXCFB_SEND_UPDATE, &param);
-	printf("send update = %d\n", r);
-	if (wait) {
-		r = ioctl(fb_fd, MXCFB_WAIT_FOR_UPDATE_COMPLETE, &MARKER);
-		printf("wait = %d\n", r);
-	}
-	int64_t end_time = current_msec();
-	printf("update time = %lld msec\n", end_time - start_time);
+	return marker;
 }
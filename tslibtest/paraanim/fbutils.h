@@ -29,24 +29,68 @@ extern "C" {
 
 extern __u32 xres, yres;
 
+struct point {
+	__s16 x, y;
+};
+
+/* Axis-aligned rectangle, as returned for the area a primitive touched.
+ * An empty rectangle has w == 0 or h == 0.
+ */
+struct fb_rect {
+	int x, y, w, h;
+};
+
 int open_framebuffer(void);
 void close_framebuffer(void);
+int open_shadow(void);
+int open_pages(void);
+void close_pages(void);
 void setcolor(unsigned colidx, unsigned value);
 void setfont(const struct fbcon_font_desc *font);
 void put_cross(int x, int y, unsigned colidx);
 void put_string(int x, int y, char *s, unsigned colidx);
+void put_string_opaque(int x, int y, char *s, unsigned colidx, unsigned bgidx);
 void put_string_center(int x, int y, char *s, unsigned colidx);
+void put_string_box(int x1, int y1, int x2, int y2, char *s,
+		    unsigned colidx, unsigned bgidx);
 void pixel (int x, int y, unsigned colidx);
 void line (int x1, int y1, int x2, int y2, unsigned colidx);
+void hline (int x1, int x2, int y, unsigned colidx);
+void vline (int x, int y1, int y2, unsigned colidx);
+void polyline (const struct point *pts, int n, unsigned colidx,
+	       struct fb_rect *bbox);
+void polyline_continue (const struct point *pts, int n, unsigned colidx,
+			struct fb_rect *bbox);
 void rect (int x1, int y1, int x2, int y2, unsigned colidx);
 void fillrect (int x1, int y1, int x2, int y2, unsigned colidx);
+void set_clip (const struct fb_rect *r);
+/* Draw a W x H image of DEPTH (1 or 4) bit pixels at (X, Y).  Rows are
+ * PITCH bytes apart, pixels packed most significant bits first, and
+ * pixel values are color indices looked up in PALETTE.
+ */
+void put_bitmap (int x, int y, int w, int h, const unsigned char *data,
+		 int pitch, int depth, const unsigned *palette);
 
 /*** EPD ***/
 
 #define MXC_DAMAGE_MODE_FULL       0x01
 #define MXC_DAMAGE_MODE_MONOCHROME 0x02
+/* push_buffer(): copy to the framebuffer instead of updating from the
+ * buffer */
+#define MXC_DAMAGE_MODE_COPY       0x04
+
+__u32 mxc_damage(int x, int y, int w, int h, int mode, int wait);
+__u32 flush_screen(int mode, int wait);
 
-void mxc_damage(int x, int y, int w, int h, int mode, int wait);
+/* Pixels the EPDC can update the panel from directly, kept in spare
+ * framebuffer memory.  NULL if there is not enough of it left.
+ */
+struct fb_buffer;
+struct fb_buffer *alloc_update_buffer(int w, int h);
+void free_update_buffer(struct fb_buffer *b);
+int draw_to_buffer(struct fb_buffer *b);
+__u32 push_buffer(const struct fb_buffer *b, const struct fb_rect *src,
+		  int x, int y, int mode);
 
 #ifdef __cplusplus
 }
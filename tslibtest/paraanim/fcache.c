@@ -0,0 +1,504 @@
+/*
+ * fcache.c
+ *
+ * Pre-rendered, run-length encoded animation frames
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fcache.h"
+#include "fbutils.h"
+
+/* A frame is kept as, for every row, the x positions where the color
+ * flips, starting from the background.  A row always has an even
+ * number of them: pairs [on, off) of stroke pixels, with off == width
+ * for a stroke that runs to the right edge.  Empty rows cost nothing
+ * but their offset.
+ */
+struct fcache_frame {
+	uint32_t *rows;		/* height + 1 offsets into edges */
+	uint16_t *edges;
+	size_t bytes;
+};
+
+enum { FC_EMPTY, FC_QUEUED, FC_READY };
+
+struct fcache_entry {
+	int state;
+	uint32_t hash;		/* of the strokes the entry is (being) made from */
+	struct fcache_frame *frame;
+};
+
+/* The strokes of one frame, copied off the animation */
+struct fcache_job {
+	struct fcache_job *next;
+	uint32_t frame, hash;
+	uint32_t nr_strokes;
+	uint32_t *counts;
+	struct point *points;
+};
+
+static int width, height;
+static int running;
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;	/* a job was queued */
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;	/* the queue ran dry */
+static struct fcache_job *queue, **queue_tail = &queue;
+static int busy;		/* the thread is rendering a job */
+static int stopping;
+
+/* Entries are only created and dropped by the caller's thread; the
+ * rendering thread fills them in under the lock. */
+static struct fcache_entry *entries;
+static uint32_t nr_entries;
+
+/* 8 bits per pixel, so strokes are plotted by the very same code as
+ * on the screen; only the rows a frame touches are cleared again. */
+static unsigned char *scratch;
+static unsigned char **scratch_rows;
+
+static struct fcache_stats stats;
+
+static uint32_t frame_hash(const struct anim *a, uint32_t frame)
+{
+	const struct anim_range *f = anim_frame_range(a, frame);
+	const unsigned char *p;
+	uint32_t h = 2166136261u;
+	size_t i, n;
+
+	if (f->count == 0)
+		return h;
+	p = (const unsigned char *)anim_stroke_points(a, f->first);
+	n = (a->strokes [f->first + f->count - 1].first +
+	     a->strokes [f->first + f->count - 1].count -
+	     a->strokes [f->first].first) * sizeof(struct point);
+	for (i = 0; i < n; i++)
+		h = (h ^ p [i]) * 16777619u;
+	/* the same points split into other strokes draw something else */
+	for (i = f->first; i < f->first + f->count; i++)
+		h = (h ^ a->strokes [i].count) * 16777619u;
+	return h;
+}
+
+static void free_frame(struct fcache_frame *f)
+{
+	if (f == NULL)
+		return;
+	stats.bytes -= f->bytes;
+	stats.frames--;
+	free(f);
+}
+
+/* Rasterize JOB into the scratch raster and encode it */
+static struct fcache_frame *render(const struct fcache_job *job)
+{
+	const struct point *p = job->points;
+	struct fcache_frame *f;
+	uint32_t s, i, n = 0;
+	int y, x, y1 = height, y2 = -1, on;
+	size_t bytes;
+
+	for (s = 0; s < job->nr_strokes; p += job->counts [s++]) {
+		anim_raster_stroke(scratch_rows, width, height, p, job->counts [s]);
+		for (i = 0; i < job->counts [s]; i++) {
+			if (p [i].y < y1) y1 = p [i].y;
+			if (p [i].y > y2) y2 = p [i].y;
+		}
+	}
+	if (y1 < 0) y1 = 0;
+	if (y2 >= height) y2 = height - 1;
+
+	/* count first, so the frame is a single allocation */
+	for (y = y1; y <= y2; y++)
+		for (x = 0, on = 0; x < width; x++)
+			if (scratch_rows [y][x] != on) {
+				on = !on;
+				n++;
+			}
+	for (y = y1; y <= y2; y++)
+		if (scratch_rows [y][width - 1])
+			n++;
+
+	bytes = sizeof(*f) + (height + 1) * sizeof(uint32_t) + n * sizeof(uint16_t);
+	f = malloc(bytes);
+	if (f == NULL)
+		goto out;
+	f->rows = (uint32_t *)(f + 1);
+	f->edges = (uint16_t *)(f->rows + height + 1);
+	f->bytes = bytes;
+
+	for (y = 0, n = 0; y < height; y++) {
+		f->rows [y] = n;
+		if (y < y1 || y > y2)
+			continue;
+		for (x = 0, on = 0; x < width; x++)
+			if (scratch_rows [y][x] != on) {
+				on = !on;
+				f->edges [n++] = x;
+			}
+		if (on)
+			f->edges [n++] = width;
+	}
+	f->rows [height] = n;
+
+out:
+	for (y = y1; y <= y2; y++)
+		memset(scratch_rows [y], 0, width);
+	return f;
+}
+
+static void free_job(struct fcache_job *job)
+{
+	free(job->counts);
+	free(job->points);
+	free(job);
+}
+
+static void *fcache_thread(void *arg)
+{
+	struct fcache_job *job;
+	struct fcache_frame *f;
+	struct fcache_entry *e;
+
+	(void)arg;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (queue == NULL && !stopping)
+			pthread_cond_wait(&work, &lock);
+		if (stopping)
+			break;
+		job = queue;
+		queue = job->next;
+		if (queue == NULL)
+			queue_tail = &queue;
+		busy = 1;
+		pthread_mutex_unlock(&lock);
+
+		f = render(job);
+
+		pthread_mutex_lock(&lock);
+		busy = 0;
+		e = &entries [job->frame];
+		/* the frame may have changed again while it was rendered */
+		if (f && e->state == FC_QUEUED && e->hash == job->hash) {
+			e->frame = f;
+			e->state = FC_READY;
+			stats.rendered++;
+			stats.bytes += f->bytes;
+			stats.frames++;
+		} else {
+			if (e->state == FC_QUEUED && e->hash == job->hash)
+				e->state = FC_EMPTY;
+			free(f);
+		}
+		free_job(job);
+		if (queue == NULL)
+			pthread_cond_broadcast(&idle);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+int fcache_init(int w, int h)
+{
+	int y;
+
+	if (running)
+		return 0;
+	width = w;
+	height = h;
+	scratch = calloc(w, h);
+	scratch_rows = malloc(h * sizeof(*scratch_rows));
+	if (scratch == NULL || scratch_rows == NULL) {
+		perror("fcache");
+		goto fail;
+	}
+	for (y = 0; y < h; y++)
+		scratch_rows [y] = scratch + (size_t)y * w;
+
+	memset(&stats, 0, sizeof(stats));
+	stats.bytes = (size_t)w * h + h * sizeof(*scratch_rows);
+	stopping = 0;
+	if (pthread_create(&thread, NULL, fcache_thread, NULL) != 0) {
+		perror("pthread_create");
+		goto fail;
+	}
+	running = 1;
+	return 0;
+
+fail:
+	free(scratch);
+	free(scratch_rows);
+	scratch = NULL;
+	scratch_rows = NULL;
+	return -1;
+}
+
+void fcache_exit(void)
+{
+	struct fcache_job *job;
+	uint32_t i;
+
+	if (!running)
+		return;
+	pthread_mutex_lock(&lock);
+	stopping = 1;
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+	running = 0;
+
+	while ((job = queue) != NULL) {
+		queue = job->next;
+		free_job(job);
+	}
+	queue_tail = &queue;
+	for (i = 0; i < nr_entries; i++)
+		free_frame(entries [i].frame);
+	free(entries);
+	entries = NULL;
+	nr_entries = 0;
+	free(scratch);
+	free(scratch_rows);
+	scratch = NULL;
+	scratch_rows = NULL;
+}
+
+static struct fcache_job *new_job(const struct anim *a, uint32_t local,
+				  uint32_t frame, uint32_t hash)
+{
+	const struct anim_range *f = anim_frame_range(a, local);
+	struct fcache_job *job;
+	uint32_t i, n = 0;
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		return NULL;
+	job->frame = frame;
+	job->hash = hash;
+	job->nr_strokes = f->count;
+	for (i = f->first; i < f->first + f->count; i++)
+		n += a->strokes [i].count;
+	job->counts = malloc((f->count ? f->count : 1) * sizeof(*job->counts));
+	job->points = malloc((n ? n : 1) * sizeof(*job->points));
+	if (job->counts == NULL || job->points == NULL) {
+		free_job(job);
+		return NULL;
+	}
+	for (i = 0; i < f->count; i++)
+		job->counts [i] = a->strokes [f->first + i].count;
+	if (n)
+		memcpy(job->points, anim_stroke_points(a, f->first),
+		       n * sizeof(*job->points));
+	return job;
+}
+
+int fcache_update(const struct anim *a, uint32_t frame)
+{
+	const struct anim *fa;
+	struct fcache_entry *e;
+	struct fcache_job *job;
+	uint32_t hash, n, local;
+
+	if (!running)
+		return -1;
+	fa = anim_frame(a, frame, &local);
+	if (fa == NULL)
+		return -1;
+	hash = frame_hash(fa, local);
+
+	pthread_mutex_lock(&lock);
+	if (frame >= nr_entries) {
+		n = nr_entries ? nr_entries : 64;
+		while (n <= frame)
+			n *= 2;
+		e = realloc(entries, n * sizeof(*entries));
+		if (e == NULL) {
+			pthread_mutex_unlock(&lock);
+			return -1;
+		}
+		memset(e + nr_entries, 0, (n - nr_entries) * sizeof(*e));
+		entries = e;
+		nr_entries = n;
+	}
+	e = &entries [frame];
+	if (e->state != FC_EMPTY && e->hash == hash) {
+		pthread_mutex_unlock(&lock);
+		return 0;
+	}
+	if (e->state == FC_READY)
+		stats.invalidated++;
+	free_frame(e->frame);
+	e->frame = NULL;
+	e->state = FC_EMPTY;
+	pthread_mutex_unlock(&lock);
+
+	job = new_job(fa, local, frame, hash);
+	if (job == NULL)
+		return -1;
+
+	pthread_mutex_lock(&lock);
+	e = &entries [frame];
+	e->hash = hash;
+	e->state = FC_QUEUED;
+	*queue_tail = job;
+	queue_tail = &job->next;
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+void fcache_drop(uint32_t frame)
+{
+	struct fcache_entry *e;
+
+	if (!running)
+		return;
+	pthread_mutex_lock(&lock);
+	if (frame < nr_entries) {
+		e = &entries [frame];
+		/* a job still queued is thrown away when it is done */
+		free_frame(e->frame);
+		e->frame = NULL;
+		e->state = FC_EMPTY;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void fcache_sync(void)
+{
+	if (!running)
+		return;
+	pthread_mutex_lock(&lock);
+	while (queue != NULL || busy)
+		pthread_cond_wait(&idle, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+/* A READY entry is left alone by the thread until the caller itself
+ * invalidates it, so it can be read without the lock. */
+static const struct fcache_frame *lookup(uint32_t frame)
+{
+	const struct fcache_frame *f = NULL;
+
+	pthread_mutex_lock(&lock);
+	if (frame < nr_entries && entries [frame].state == FC_READY)
+		f = entries [frame].frame;
+	pthread_mutex_unlock(&lock);
+	return f;
+}
+
+/* Paint [x1, x2] of row Y as it is in F */
+static void draw_row(const struct fcache_frame *f, int y, int x1, int x2,
+		     unsigned fg, unsigned bg)
+{
+	const uint16_t *e = f->edges + f->rows [y];
+	const uint16_t *end = f->edges + f->rows [y + 1];
+	int x = x1, on, off;
+
+	for (; e < end && x <= x2; e += 2) {
+		on = e [0];
+		off = e [1] - 1;
+		if (off < x)
+			continue;
+		if (on > x2)
+			break;
+		if (on > x)
+			hline(x, on - 1, y, bg);
+		else
+			on = x;
+		if (off > x2)
+			off = x2;
+		hline(on, off, y, fg);
+		x = off + 1;
+	}
+	if (x <= x2)
+		hline(x, x2, y, bg);
+}
+
+int fcache_draw(uint32_t frame, unsigned fg, unsigned bg)
+{
+	const struct fcache_frame *f = lookup(frame);
+	const uint16_t *e, *end;
+	int y;
+
+	if (f == NULL) {
+		stats.misses++;
+		return -1;
+	}
+	stats.hits++;
+
+	fillrect(0, 0, width - 1, height - 1, bg);
+	for (y = 0; y < height; y++) {
+		end = f->edges + f->rows [y + 1];
+		for (e = f->edges + f->rows [y]; e < end; e += 2)
+			hline(e [0], e [1] - 1, y, fg);
+	}
+	return 0;
+}
+
+int fcache_draw_delta(uint32_t from, uint32_t to, unsigned fg, unsigned bg)
+{
+	const struct fcache_frame *a = lookup(from), *b = lookup(to);
+	const uint16_t *p, *pend, *q, *qend;
+	int y, x1, x2, n;
+
+	if (a == NULL || b == NULL) {
+		stats.misses++;
+		return -1;
+	}
+	stats.hits++;
+
+	for (y = 0; y < height; y++) {
+		p = a->edges + a->rows [y];
+		pend = a->edges + a->rows [y + 1];
+		q = b->edges + b->rows [y];
+		qend = b->edges + b->rows [y + 1];
+		if (pend - p == qend - q &&
+		    memcmp(p, q, (pend - p) * sizeof(*p)) == 0)
+			continue;
+
+		/* A pixel differs where an odd number of the edges found in
+		 * only one of the rows lie at or left of it.  Both rows have
+		 * an even number of edges, so the differing pixels run from
+		 * the first such edge up to just before the last one. */
+		x1 = width;
+		x2 = -1;
+		n = 0;
+		while (p < pend || q < qend) {
+			int x;
+
+			if (q == qend || (p < pend && *p < *q)) {
+				x = *p++;
+			} else if (p == pend || *q < *p) {
+				x = *q++;
+			} else {
+				p++;
+				q++;
+				continue;
+			}
+			if (n++ == 0)
+				x1 = x;
+			x2 = x - 1;
+		}
+		if (n)
+			draw_row(b, y, x1, x2, fg, bg);
+	}
+	return 0;
+}
+
+const struct fcache_stats *fcache_get_stats(void)
+{
+	return &stats;
+}
@@ -0,0 +1,70 @@
+/*
+ * fcache.h
+ *
+ * Pre-rendered, run-length encoded animation frames
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _FCACHE_H
+#define _FCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "anim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fcache_stats {
+	unsigned long rendered;		/* frames rasterized by the thread */
+	unsigned long invalidated;	/* entries dropped because the frame changed */
+	unsigned long hits;		/* frames drawn from the cache */
+	unsigned long misses;		/* frames the caller had to draw itself */
+	size_t bytes;			/* held by encoded frames and the scratch raster */
+	size_t frames;			/* frames currently cached */
+};
+
+/* Start the rendering thread for WIDTH x HEIGHT frames */
+int fcache_init(int width, int height);
+/* Stop the thread and drop every entry */
+void fcache_exit(void);
+
+/* Queue FRAME of A for rendering unless an entry for exactly these
+ * strokes exists already; an entry left from different strokes is
+ * thrown away.  The strokes are copied, so A may change afterwards.
+ * Returns -1 if the cache is not running or memory runs out.
+ */
+int fcache_update(const struct anim *a, uint32_t frame);
+
+/* Forget FRAME, e.g. once it is no longer held in memory */
+void fcache_drop(uint32_t frame);
+
+/* Wait until every queued frame has been rendered */
+void fcache_sync(void);
+
+/* Draw the cached FRAME over the whole screen, strokes in FG on BG.
+ * Returns -1, drawing nothing, if the frame is not cached (yet).
+ */
+int fcache_draw(uint32_t frame, unsigned fg, unsigned bg);
+
+/* Turn the screen from showing cached frame FROM into showing cached
+ * frame TO, repainting only the pixels between the first and the last
+ * one that differ on each row.  Returns -1, drawing nothing, unless
+ * both frames are cached.
+ */
+int fcache_draw_delta(uint32_t from, uint32_t to, unsigned fg, unsigned bg);
+
+const struct fcache_stats *fcache_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FCACHE_H */
@@ -17,12 +17,16 @@
 extern "C" {
 #endif
 
+struct font_map;
+
 struct fbcon_font_desc {
     int idx;
     char *name;
     int width, height;
-    char *data;
+    const char *data;
     int pref;
+    int charcount;		/* glyphs in data, 0 means 256 */
+    const struct font_map *map;	/* Unicode to glyph index, or NULL */
 };
 
 #define VGA8x8_IDX	0
@@ -32,6 +36,7 @@ struct fbcon_font_desc {
 #define SUN8x16_IDX	4
 #define SUN12x22_IDX	5
 #define ACORN8x8_IDX	6
+#define PSF_IDX		-1	/* loaded at run time, see psf.h */
 
 extern struct fbcon_font_desc	font_vga_8x8,
 				font_vga_8x16;
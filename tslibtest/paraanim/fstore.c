@@ -0,0 +1,235 @@
+/*
+ * fstore.c
+ *
+ * Frame store: old frames spilled to a file, faulted back on demand
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+/* a long session may spill more than 2 GB */
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fstore.h"
+#include "animfile.h"
+
+/* Frames read back at once: playback draws a frame as the difference
+ * to the one before, so both must be at hand */
+#define FAULT_FRAMES 2
+
+struct spill_entry {
+	uint64_t offset;
+	uint32_t length;
+};
+
+static int fd = -1;
+static uint32_t window;
+
+/* Where every spilled frame went; the file is only appended to */
+static struct spill_entry *spilled;
+static uint32_t nr_spilled, max_spilled;
+static uint64_t spill_end;
+
+/* Frames read back live in an animation of their own.  faulted_frame
+ * holds their frame numbers, oldest first, and last_used the index of
+ * the one anim_frame() handed out last. */
+static struct anim faulted;
+static uint32_t faulted_frame [FAULT_FRAMES];
+static uint32_t last_used;
+static unsigned char *buf;
+static size_t buf_size;
+
+static struct fstore_stats stats;
+
+static int write_at(const void *p, size_t n, uint64_t offset)
+{
+	ssize_t r;
+
+	while (n) {
+		r = pwrite(fd, p, n, offset);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		p = (const unsigned char *)p + r;
+		n -= r;
+		offset += r;
+	}
+	return 0;
+}
+
+static int read_at(void *p, size_t n, uint64_t offset)
+{
+	ssize_t r;
+
+	while (n) {
+		r = pread(fd, p, n, offset);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		p = (unsigned char *)p + r;
+		n -= r;
+		offset += r;
+	}
+	return 0;
+}
+
+/* Append spilled FRAME to the faulted animation */
+static int read_back(uint32_t frame)
+{
+	const struct spill_entry *e = &spilled [frame];
+	unsigned char *p;
+
+	if (e->length > buf_size) {
+		p = realloc(buf, e->length);
+		if (p == NULL)
+			return -1;
+		buf = p;
+		buf_size = e->length;
+	}
+	if (read_at(buf, e->length, e->offset) < 0 ||
+	    animfile_decode(buf, e->length, &faulted) < 0) {
+		fprintf(stderr, "fstore: frame %u could not be read back\n", frame);
+		return -1;
+	}
+	faulted_frame [faulted.nr_frames - faulted.base - 1] = frame;
+	stats.faults++;
+	return 0;
+}
+
+/* Drop the N oldest faulted frames */
+static void forget(uint32_t n)
+{
+	uint32_t held = faulted.nr_frames - faulted.base;
+
+	anim_drop(&faulted, n);
+	memmove(faulted_frame, faulted_frame + n, (held - n) * sizeof(*faulted_frame));
+}
+
+static const struct anim *fault(const struct anim *a, uint32_t frame,
+				uint32_t *local)
+{
+	uint32_t held = faulted.nr_frames - faulted.base, k, keep;
+
+	/* there is only one store, behind whichever animation asks */
+	(void)a;
+	if (frame >= nr_spilled)
+		return NULL;
+	for (k = 0; k < held; k++)
+		if (faulted_frame [k] == frame)
+			goto found;
+
+	/* Make room, keeping the frame used last: it is the one a delta
+	 * is drawn from */
+	if (held == FAULT_FRAMES) {
+		keep = faulted_frame [last_used];
+		if (last_used == held - 1) {
+			forget(held - 1);
+		} else {
+			forget(held);
+			if (read_back(keep) < 0)
+				return NULL;
+		}
+	}
+	if (read_back(frame) < 0)
+		return NULL;
+	k = faulted.nr_frames - faulted.base - 1;
+
+found:
+	last_used = k;
+	*local = faulted.base + k;
+	return &faulted;
+}
+
+int fstore_init(struct anim *a, const char *path, uint32_t frames)
+{
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	/* nobody else needs to see it, and it is gone after a crash too */
+	unlink(path);
+
+	window = frames ? frames : 1;
+	nr_spilled = a->base;
+	spill_end = 0;
+	anim_init(&faulted);
+	memset(&stats, 0, sizeof(stats));
+	a->fault = fault;
+	return 0;
+}
+
+void fstore_exit(struct anim *a)
+{
+	if (fd < 0)
+		return;
+	a->fault = NULL;
+	close(fd);
+	fd = -1;
+	anim_free(&faulted);
+	free(spilled);
+	spilled = NULL;
+	nr_spilled = max_spilled = 0;
+	free(buf);
+	buf = NULL;
+	buf_size = 0;
+}
+
+uint32_t fstore_trim(struct anim *a)
+{
+	struct spill_entry *e;
+	unsigned char *data;
+	size_t length;
+	uint32_t frame, n = 0, max;
+
+	if (fd < 0)
+		return 0;
+	for (frame = a->base; a->nr_frames - frame > window; frame++) {
+		if (nr_spilled == max_spilled) {
+			max = max_spilled ? max_spilled * 2 : 256;
+			e = realloc(spilled, max * sizeof(*spilled));
+			if (e == NULL)
+				break;
+			spilled = e;
+			max_spilled = max;
+		}
+		data = animfile_encode(a, frame, &length);
+		if (data == NULL)
+			break;
+		if (write_at(data, length, spill_end) < 0) {
+			perror("fstore");
+			free(data);
+			break;
+		}
+		free(data);
+		spilled [nr_spilled].offset = spill_end;
+		spilled [nr_spilled].length = length;
+		nr_spilled++;
+		spill_end += length;
+		stats.spills++;
+		n++;
+	}
+	/* one move for all of them */
+	anim_drop(a, n);
+	return n;
+}
+
+const struct fstore_stats *fstore_get_stats(const struct anim *a)
+{
+	stats.resident = anim_bytes(a) + anim_bytes(&faulted) +
+		max_spilled * sizeof(*spilled) + buf_size;
+	stats.spilled = spill_end;
+	return &stats;
+}
@@ -0,0 +1,51 @@
+/*
+ * fstore.h
+ *
+ * Frame store: old frames spilled to a file, faulted back on demand
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _FSTORE_H
+#define _FSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "anim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fstore_stats {
+	size_t resident;		/* bytes held for frames in memory */
+	unsigned long spills;		/* frames written out */
+	unsigned long faults;		/* frames read back */
+	unsigned long long spilled;	/* bytes in the backing file */
+};
+
+/* Keep at most WINDOW (>= 1) frames of A in memory, spilling older
+ * ones to PATH, which is created empty and removed again at once: it
+ * only lives as long as the process.  Dropped frames are then served
+ * by anim_frame().  Returns -1 with a message on stderr on failure.
+ */
+int fstore_init(struct anim *a, const char *path, uint32_t window);
+void fstore_exit(struct anim *a);
+
+/* Spill the oldest frames of A until WINDOW are left.  Returns the
+ * number of frames spilled, so the caller can forget them too.
+ */
+uint32_t fstore_trim(struct anim *a);
+
+const struct fstore_stats *fstore_get_stats(const struct anim *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FSTORE_H */
@@ -0,0 +1,135 @@
+/*
+ * fstorecheck.c
+ *
+ * Playback through spilled frames, forwards and backwards
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ *
+ * Usage: fstorecheck [frames]
+ *
+ * Keeps a single frame in memory and spills the others (see fstore.h),
+ * steps through all of them with anim_draw_delta() up to the last one
+ * and back down to the first, and checks that the panel ends up showing
+ * what drawing the first frame straight away shows.  Going backwards
+ * faults in frames in the opposite order from the one they were last
+ * read back in.  Runs on the framebuffer simulator; TSLIB_FBDEVICE
+ * defaults to sim:160x120x8.  Exits with 1 if the pictures differ.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fbutils.h"
+#include "anim.h"
+#include "fstore.h"
+
+#define BLACK 0
+#define WHITE 15
+
+#define SPILL_PATH "fstorecheck.spill"
+#define STEPPED_DUMP "fstorecheck.stepped.pgm"
+#define DIRECT_DUMP "fstorecheck.direct.pgm"
+
+/* A few strokes per frame, some of them carried over from the frame
+ * before so that the deltas have something in common */
+static int build(struct anim *a, int frames)
+{
+	int f, s, k;
+
+	for (f = 0; f < frames; f++) {
+		for (s = f / 2; s < f / 2 + 4; s++) {
+			if (anim_begin_stroke(a) < 0)
+				return -1;
+			for (k = 0; k < 4; k++)
+				if (anim_add_point(a, (s * 37 + k * 29) % xres,
+						   (s * 23 + k * 41) % yres) < 0)
+					return -1;
+			anim_end_stroke(a);
+		}
+		if (anim_commit(a) < 0)
+			return -1;
+		fstore_trim(a);
+	}
+	return 0;
+}
+
+static int run(const char *dump, int frames, int stepped)
+{
+	struct anim a;
+	int f, ret = -1;
+
+	setenv("FBSIM_DUMP", dump, 1);
+	if (open_framebuffer())
+		return -1;
+	for (f = 0; f < 16; f++)
+		setcolor(f, f * 0x111111);
+	anim_init(&a);
+	if (fstore_init(&a, SPILL_PATH, 1) < 0 || build(&a, frames) < 0)
+		goto out;
+
+	fillrect(0, 0, xres - 1, yres - 1, WHITE);
+	if (stepped) {
+		anim_draw_frame(&a, 0, BLACK, WHITE);
+		for (f = 1; f < frames; f++)
+			anim_draw_delta(&a, f - 1, f, BLACK, WHITE);
+		for (f = frames - 1; f > 0; f--)
+			anim_draw_delta(&a, f, f - 1, BLACK, WHITE);
+	} else {
+		anim_draw_frame(&a, 0, BLACK, WHITE);
+	}
+	flush_screen(0, 1);
+	printf("%s: %lu frames spilled, %lu read back\n",
+	       stepped ? "stepped" : "direct", fstore_get_stats(&a)->spills,
+	       fstore_get_stats(&a)->faults);
+	ret = 0;
+out:
+	fstore_exit(&a);
+	anim_free(&a);
+	close_framebuffer();
+	return ret;
+}
+
+static int same_file(const char *p1, const char *p2)
+{
+	FILE *f1 = fopen(p1, "rb"), *f2 = fopen(p2, "rb");
+	int c1 = 0, c2 = 0;
+
+	if (f1 && f2)
+		do {
+			c1 = getc(f1);
+			c2 = getc(f2);
+		} while (c1 == c2 && c1 != EOF);
+	if (f1)
+		fclose(f1);
+	if (f2)
+		fclose(f2);
+	return f1 && f2 && c1 == c2;
+}
+
+int main(int argc, char **argv)
+{
+	int frames = 12, same;
+
+	if (argc >= 2)
+		frames = atoi(argv[1]);
+	if (frames < 2) {
+		fprintf(stderr, "fstorecheck: need at least 2 frames\n");
+		return 2;
+	}
+	setenv("TSLIB_FBDEVICE", "sim:160x120x8", 0);
+
+	if (run(STEPPED_DUMP, frames, 1) < 0 || run(DIRECT_DUMP, frames, 0) < 0)
+		return 2;
+	same = same_file(STEPPED_DUMP, DIRECT_DUMP);
+	unlink(STEPPED_DUMP);
+	unlink(DIRECT_DUMP);
+
+	printf("%s\n", same ? "ok" : "FAILED: pictures differ");
+	return same ? 0 : 1;
+}
@@ -0,0 +1,246 @@
+/*
+ * glyph.c
+ *
+ * Pre-expanded glyph cache for fbutils text drawing
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glyph.h"
+#include "psf.h"
+
+#define RUN_SLOTS	4
+#define IMAGE_SLOTS	4
+
+struct run_cache {
+	const struct fbcon_font_desc *font;
+	struct glyph *glyphs;
+	struct glyph_run *pool;
+	unsigned long used;
+};
+
+struct image_cache {
+	const struct fbcon_font_desc *font;
+	unsigned fg, bg;
+	int bits_per_pixel;
+	unsigned char *pixels;
+	unsigned char *valid;
+	unsigned long used;
+};
+
+static struct run_cache run_cache [RUN_SLOTS];
+static struct image_cache image_cache [IMAGE_SLOTS];
+static unsigned long tick;
+
+static const unsigned char *glyph_bits(const struct fbcon_font_desc *font,
+				       unsigned c)
+{
+	int pitch = (font->width + 7) / 8;
+
+	return (const unsigned char *)font->data + c * font->height * pitch;
+}
+
+static int bit_set(const unsigned char *row, int x)
+{
+	return row [x >> 3] & (0x80 >> (x & 7));
+}
+
+/* Split every glyph of FONT into runs; counts first, then fills */
+static int build_runs(struct run_cache *rc, const struct fbcon_font_desc *font)
+{
+	int pitch = (font->width + 7) / 8;
+	const unsigned char *bits;
+	struct glyph_run *run;
+	unsigned c, count = font_charcount(font);
+	int i, x, start, total = 0;
+
+	for (c = 0; c < count; c++) {
+		bits = glyph_bits(font, c);
+		for (i = 0; i < font->height; i++, bits += pitch)
+			for (x = 0; x < font->width; x++)
+				if (bit_set(bits, x) && (x == 0 || !bit_set(bits, x - 1)))
+					total++;
+	}
+
+	free(rc->pool);
+	free(rc->glyphs);
+	rc->pool = malloc((total ? total : 1) * sizeof(*rc->pool));
+	rc->glyphs = malloc(count * sizeof(*rc->glyphs));
+	if (rc->pool == NULL || rc->glyphs == NULL) {
+		free(rc->pool);
+		free(rc->glyphs);
+		rc->pool = NULL;
+		rc->glyphs = NULL;
+		rc->font = NULL;
+		return -1;
+	}
+
+	run = rc->pool;
+	for (c = 0; c < count; c++) {
+		rc->glyphs [c].runs = run;
+		bits = glyph_bits(font, c);
+		for (i = 0; i < font->height; i++, bits += pitch) {
+			for (x = 0; x < font->width; ) {
+				if (!bit_set(bits, x)) {
+					x++;
+					continue;
+				}
+				for (start = x; x < font->width && bit_set(bits, x); x++)
+					;
+				run->row = i;
+				run->x = start;
+				run->len = x - start;
+				run++;
+			}
+		}
+		rc->glyphs [c].nr_runs = run - rc->glyphs [c].runs;
+	}
+
+	rc->font = font;
+	return 0;
+}
+
+const struct glyph *glyph_runs(const struct fbcon_font_desc *font, unsigned c)
+{
+	struct run_cache *rc = NULL;
+	int i;
+
+	c %= font_charcount(font);
+	tick++;
+
+	for (i = 0; i < RUN_SLOTS; i++) {
+		if (run_cache [i].font == font) {
+			run_cache [i].used = tick;
+			return &run_cache [i].glyphs [c];
+		}
+		if (rc == NULL || run_cache [i].used < rc->used)
+			rc = &run_cache [i];
+	}
+
+	if (build_runs(rc, font) < 0)
+		return NULL;
+	rc->used = tick;
+	return &rc->glyphs [c];
+}
+
+/* Bytes per row of a glyph image */
+static size_t image_pitch(const struct fbcon_font_desc *font,
+			  int bits_per_pixel)
+{
+	return (font->width * bits_per_pixel + 7) / 8;
+}
+
+static void expand(unsigned char *dst, const struct fbcon_font_desc *font,
+		   unsigned c, unsigned fg, unsigned bg, int bits_per_pixel)
+{
+	int pitch = (font->width + 7) / 8;
+	const unsigned char *bits = glyph_bits(font, c);
+	size_t out = image_pitch(font, bits_per_pixel);
+	int i, x, b;
+
+	if (bits_per_pixel < 8) {
+		/* packed, leftmost pixel in the high bits */
+		memset(dst, 0, out * font->height);
+		for (i = 0; i < font->height; i++, bits += pitch) {
+			for (x = 0, b = 0; x < font->width; x++, b += bits_per_pixel)
+				dst [b >> 3] |= ((bit_set(bits, x) ? fg : bg) &
+						 ((1u << bits_per_pixel) - 1)) <<
+						(8 - bits_per_pixel - (b & 7));
+			dst += out;
+		}
+		return;
+	}
+
+	for (i = 0; i < font->height; i++, bits += pitch)
+		for (x = 0; x < font->width; x++) {
+			unsigned v = bit_set(bits, x) ? fg : bg;
+			switch (bits_per_pixel) {
+			case 8:
+			default:
+				*dst++ = v;
+				break;
+			case 16:
+				*(uint16_t *)dst = v;
+				dst += 2;
+				break;
+			case 32:
+				*(uint32_t *)dst = v;
+				dst += 4;
+				break;
+			}
+		}
+}
+
+const unsigned char *glyph_image(const struct fbcon_font_desc *font, unsigned c,
+				 unsigned fg, unsigned bg, int bits_per_pixel)
+{
+	struct image_cache *ic = NULL;
+	size_t size = image_pitch(font, bits_per_pixel) * font->height;
+	unsigned count = font_charcount(font);
+	int i;
+
+	c %= count;
+	tick++;
+
+	for (i = 0; i < IMAGE_SLOTS; i++) {
+		struct image_cache *p = &image_cache [i];
+		if (p->pixels && p->font == font && p->fg == fg && p->bg == bg &&
+		    p->bits_per_pixel == bits_per_pixel) {
+			ic = p;
+			break;
+		}
+	}
+
+	if (ic == NULL) {
+		for (i = 0; i < IMAGE_SLOTS; i++)
+			if (ic == NULL || image_cache [i].used < ic->used)
+				ic = &image_cache [i];
+		free(ic->pixels);
+		free(ic->valid);
+		ic->pixels = malloc(size * count);
+		ic->valid = calloc(count, 1);
+		if (ic->pixels == NULL || ic->valid == NULL) {
+			free(ic->pixels);
+			free(ic->valid);
+			ic->pixels = NULL;
+			ic->valid = NULL;
+			return NULL;
+		}
+		ic->font = font;
+		ic->fg = fg;
+		ic->bg = bg;
+		ic->bits_per_pixel = bits_per_pixel;
+	}
+
+	ic->used = tick;
+	if (!ic->valid [c]) {
+		expand(ic->pixels + c * size, font, c, fg, bg, bits_per_pixel);
+		ic->valid [c] = 1;
+	}
+	return ic->pixels + c * size;
+}
+
+void glyph_flush(const struct fbcon_font_desc *font)
+{
+	int i;
+
+	for (i = 0; i < RUN_SLOTS; i++)
+		if (run_cache [i].font == font)
+			run_cache [i].font = NULL;
+	for (i = 0; i < IMAGE_SLOTS; i++)
+		if (image_cache [i].font == font) {
+			free(image_cache [i].pixels);
+			free(image_cache [i].valid);
+			image_cache [i].pixels = NULL;
+			image_cache [i].valid = NULL;
+			image_cache [i].font = NULL;
+		}
+}
@@ -0,0 +1,53 @@
+/*
+ * glyph.h
+ *
+ * Pre-expanded glyph cache for fbutils text drawing
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _GLYPH_H
+#define _GLYPH_H
+
+#include "font.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A horizontal run of set pixels within a glyph */
+struct glyph_run {
+	unsigned char row, x, len;
+};
+
+struct glyph {
+	int nr_runs;
+	const struct glyph_run *runs;
+};
+
+/* Runs of glyph number C in FONT (see font_glyph()), for transparent
+ * text.  Only depends on the font, so one table per font serves every
+ * color and pixel format.
+ */
+const struct glyph *glyph_runs(const struct fbcon_font_desc *font, unsigned c);
+
+/* Glyph C of FONT rendered with pixel values FG and BG in a
+ * BITS_PER_PIXEL format, as font->height rows of
+ * (font->width * bits_per_pixel + 7) / 8 bytes, ready to copy row by row
+ * for opaque text.  Returns NULL if memory runs out.
+ */
+const unsigned char *glyph_image(const struct fbcon_font_desc *font, unsigned c,
+				 unsigned fg, unsigned bg, int bits_per_pixel);
+
+/* Forget everything cached for FONT, before its memory goes away */
+void glyph_flush(const struct fbcon_font_desc *font);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _GLYPH_H */
@@ -0,0 +1,230 @@
+/*
+ * input.c
+ *
+ * Touchscreen input thread feeding a lock-free sample ring
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "input.h"
+
+#define INPUT_BATCH 32
+
+/* Single producer, single consumer: only the input thread moves head
+ * and only the renderer moves tail.  A sample is written before head
+ * is published, and read before tail gives the slot back.
+ */
+static struct ts_sample ring [INPUT_RING_SIZE];
+static volatile uint32_t head, tail;
+
+static struct tsdev *input_ts;
+static pthread_t thread;
+static int running;
+static volatile int failed;	/* the thread gave up reading */
+static int wake_fd = -1;	/* readable while samples are queued */
+static int stop_fd = -1;	/* tells the thread to exit */
+static struct input_stats stats;
+
+static void set_realtime(int prio)
+{
+	struct sched_param sp;
+	int r;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		perror("mlockall");
+
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = prio;
+	r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+	if (r != 0)
+		fprintf(stderr, "input: SCHED_FIFO: %s\n", strerror(r));
+}
+
+static void *input_thread(void *arg)
+{
+	struct ts_sample samps [INPUT_BATCH];
+	struct pollfd pfd [2];
+	uint32_t queued;
+	uint64_t one = 1;
+	int i, n, pushed;
+
+	if ((intptr_t)arg > 0)
+		set_realtime((intptr_t)arg);
+
+	pfd [0].fd = ts_fd(input_ts);
+	pfd [0].events = POLLIN;
+	pfd [1].fd = stop_fd;
+	pfd [1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("input: poll");
+			goto fail;
+		}
+		if (pfd [1].revents)
+			break;
+
+		n = ts_read(input_ts, samps, INPUT_BATCH);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			perror("input: ts_read");
+			goto fail;
+		}
+
+		pushed = 0;
+		for (i = 0; i < n; i++) {
+			if (head - tail == INPUT_RING_SIZE) {
+				stats.dropped++;
+				continue;
+			}
+			ring [head % INPUT_RING_SIZE] = samps [i];
+			__sync_synchronize();
+			head++;
+			pushed++;
+		}
+		stats.samples += n;
+		queued = head - tail;
+		if (queued > stats.max_queued)
+			stats.max_queued = queued;
+
+		if (pushed && write(wake_fd, &one, sizeof(one)) < 0)
+			perror("input: write eventfd");
+	}
+	return NULL;
+
+fail:
+	/* Nothing will come any more; let the renderer find out */
+	failed = 1;
+	__sync_synchronize();
+	if (write(wake_fd, &one, sizeof(one)) < 0)
+		perror("input: write eventfd");
+	return NULL;
+}
+
+int input_start(struct tsdev *ts, int rt_prio)
+{
+	if (running)
+		return 0;
+
+	wake_fd = eventfd(0, 0);
+	stop_fd = eventfd(0, 0);
+	if (wake_fd < 0 || stop_fd < 0) {
+		perror("eventfd");
+		goto fail;
+	}
+
+	input_ts = ts;
+	head = tail = 0;
+	failed = 0;
+	memset(&stats, 0, sizeof(stats));
+	if (pthread_create(&thread, NULL, input_thread,
+			   (void *)(intptr_t)rt_prio) != 0) {
+		perror("pthread_create");
+		goto fail;
+	}
+	running = 1;
+	return 0;
+
+fail:
+	if (wake_fd >= 0)
+		close(wake_fd);
+	if (stop_fd >= 0)
+		close(stop_fd);
+	wake_fd = stop_fd = -1;
+	return -1;
+}
+
+void input_stop(void)
+{
+	uint64_t one = 1;
+
+	if (!running)
+		return;
+	if (write(stop_fd, &one, sizeof(one)) < 0)
+		perror("input: write eventfd");
+	pthread_join(thread, NULL);
+	running = 0;
+
+	close(wake_fd);
+	close(stop_fd);
+	wake_fd = stop_fd = -1;
+}
+
+int input_read(struct ts_sample *samps, int nr)
+{
+	uint32_t avail = head - tail;
+	struct timeval now;
+	long latency;
+	int i;
+
+	if (avail > (uint32_t)nr)
+		avail = nr;
+	if (avail == 0)
+		return failed ? -1 : 0;
+	__sync_synchronize();
+	for (i = 0; i < (int)avail; i++)
+		samps [i] = ring [(tail + i) % INPUT_RING_SIZE];
+	__sync_synchronize();
+	tail += avail;
+
+	/* The oldest sample of the batch waited longest */
+	gettimeofday(&now, NULL);
+	latency = (now.tv_sec - samps [0].tv.tv_sec) * 1000000L +
+		now.tv_usec - samps [0].tv.tv_usec;
+	if (latency > 0 && (unsigned long)latency > stats.max_latency_us)
+		stats.max_latency_us = latency;
+	return avail;
+}
+
+int input_wait(int timeout_ms)
+{
+	struct pollfd pfd;
+	uint64_t count;
+
+	/* The eventfd may still be set from samples already taken, so the
+	 * ring itself decides; a stale wake-up only costs a loop */
+	if (head != tail)
+		return 1;
+	if (failed)
+		return -1;
+
+	pfd.fd = wake_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, timeout_ms) > 0 &&
+	    read(wake_fd, &count, sizeof(count)) < 0)
+		perror("input: read eventfd");
+	if (head != tail)
+		return 1;
+	return failed ? -1 : 0;
+}
+
+void input_kick(void)
+{
+	uint64_t one = 1;
+
+	if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+		perror("input: write eventfd");
+}
+
+const struct input_stats *input_get_stats(void)
+{
+	return &stats;
+}
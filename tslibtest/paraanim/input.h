@@ -0,0 +1,64 @@
+/*
+ * input.h
+ *
+ * Touchscreen input thread feeding a lock-free sample ring
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _INPUT_H
+#define _INPUT_H
+
+#include <tslib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Samples buffered between the input thread and the renderer; about
+ * five seconds at 200 Hz */
+#define INPUT_RING_SIZE 1024
+
+struct input_stats {
+	unsigned long samples;		/* taken from tslib */
+	unsigned long dropped;		/* lost because the ring was full */
+	unsigned long max_queued;	/* high water mark of the ring */
+	unsigned long max_latency_us;	/* sample timestamp to input_read() */
+};
+
+/* Start a thread that reads TS (opened non-blocking) and queues every
+ * sample with its timestamp.  With RT_PRIO > 0 the thread runs
+ * SCHED_FIFO at that priority and all memory is locked, so neither
+ * the scheduler nor page faults delay it; if that is not permitted it
+ * carries on with normal priority.
+ */
+int input_start(struct tsdev *ts, int rt_prio);
+
+/* Stop and join the input thread */
+void input_stop(void);
+
+/* Take up to NR queued samples, oldest first, without blocking;
+ * returns -1 once the ring is empty and the thread has stopped on a
+ * read error */
+int input_read(struct ts_sample *samps, int nr);
+
+/* Block until a sample is queued or TIMEOUT_MS (-1 for ever) passes;
+ * returns 1 if samples are ready, -1 if none ever will be because the
+ * thread has stopped on a read error */
+int input_wait(int timeout_ms);
+
+/* Make a pending input_wait() return, e.g. when something else the
+ * caller waits for has happened */
+void input_kick(void);
+
+const struct input_stats *input_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _INPUT_H */
@@ -0,0 +1,117 @@
+/*
+ * pace.c
+ *
+ * Frame pacing for EPD updates
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "pace.h"
+#include "trace.h"
+#include "fbsim.h"
+
+/* trace_now() follows the simulator's virtual clock, and so must sleeping */
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts;
+
+	if (fbsim_active()) {
+		fbsim_sleep_until(ns);
+		return;
+	}
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/* Forget frames whose updates have completed */
+static void reap(struct pace *p)
+{
+	int i, n = 0;
+
+	for (i = 0; i < p->nr_in_flight; i++)
+		if (!epd_poll(p->in_flight [i]))
+			p->in_flight [n++] = p->in_flight [i];
+	p->nr_in_flight = n;
+}
+
+void pace_init(struct pace *p, double fps, int max_in_flight)
+{
+	memset(p, 0, sizeof(*p));
+	p->period_ns = fps > 0 ? 1e9 / fps : 0;
+	if (max_in_flight < 1)
+		max_in_flight = 1;
+	if (max_in_flight > PACE_MAX_IN_FLIGHT)
+		max_in_flight = PACE_MAX_IN_FLIGHT;
+	p->max_in_flight = max_in_flight;
+}
+
+int pace_frame(struct pace *p, int last)
+{
+	uint64_t now = trace_now(), due;
+
+	if (p->frames == 0)
+		p->start_ns = now;
+	due = p->start_ns + p->frames * p->period_ns;
+	p->frames++;
+
+	/* The frame after this one is due already: skip ahead to it */
+	if (!last && p->period_ns && now >= due + p->period_ns) {
+		p->dropped++;
+		return 0;
+	}
+	if (now < due)
+		sleep_until(due);
+	p->shown++;
+	return 1;
+}
+
+void pace_slot(struct pace *p)
+{
+	reap(p);
+	while (p->nr_in_flight >= p->max_in_flight) {
+		epd_wait(p->in_flight [0]);
+		reap(p);
+	}
+}
+
+int pace_ready(struct pace *p)
+{
+	reap(p);
+	return p->nr_in_flight < p->max_in_flight;
+}
+
+void pace_submitted(struct pace *p, epd_marker_t marker)
+{
+	if (marker == 0)
+		return;
+	if (p->nr_in_flight == PACE_MAX_IN_FLIGHT)
+		pace_slot(p);
+	p->in_flight [p->nr_in_flight++] = marker;
+}
+
+void pace_finish(struct pace *p)
+{
+	int i;
+
+	for (i = 0; i < p->nr_in_flight; i++)
+		epd_wait(p->in_flight [i]);
+	p->nr_in_flight = 0;
+	p->end_ns = trace_now();
+}
+
+double pace_fps(const struct pace *p)
+{
+	if (p->end_ns <= p->start_ns)
+		return 0;
+	return p->shown * 1e9 / (p->end_ns - p->start_ns);
+}
@@ -0,0 +1,71 @@
+/*
+ * pace.h
+ *
+ * Frame pacing for EPD updates
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _PACE_H
+#define _PACE_H
+
+#include <stdint.h>
+
+#include "epd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Upper bound for the frames a pacer keeps in flight */
+#define PACE_MAX_IN_FLIGHT 16
+
+/* A pacer releases frames at a target rate and keeps at most
+ * max_in_flight of them on the panel at once.  When the panel falls
+ * behind, frames that are already overdue are dropped rather than
+ * queued, so what is shown is always the latest state.
+ */
+struct pace {
+	uint64_t period_ns;		/* 0 for as fast as the panel allows */
+	int max_in_flight;
+	epd_marker_t in_flight [PACE_MAX_IN_FLIGHT];
+	int nr_in_flight;
+	uint64_t start_ns, end_ns;
+	unsigned long frames;		/* offered to pace_frame() */
+	unsigned long shown;
+	unsigned long dropped;
+};
+
+void pace_init(struct pace *p, double fps, int max_in_flight);
+
+/* Decide on the next frame: returns 0 if it should be dropped, or
+ * sleeps until it is due and returns 1.  The LAST frame of a sequence
+ * is never dropped.
+ */
+int pace_frame(struct pace *p, int last);
+
+/* Wait until another frame may be submitted; call it after rendering
+ * so the drawing overlaps with the updates still running */
+void pace_slot(struct pace *p);
+
+/* Nonzero if a frame can be submitted right now without waiting */
+int pace_ready(struct pace *p);
+
+/* Record the marker of the last update of a submitted frame */
+void pace_submitted(struct pace *p, epd_marker_t marker);
+
+/* Wait for every frame in flight and stop the clock */
+void pace_finish(struct pace *p);
+
+/* Frames shown per second between the first frame and pace_finish() */
+double pace_fps(const struct pace *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PACE_H */
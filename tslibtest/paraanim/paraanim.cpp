@@ -24,14 +24,37 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <list>
+#include <algorithm>
+#include <string>
 
 #include <tslib.h>
 #include "fbutils.h"
+#include "damage.h"
+#include "epd.h"
 #include "font.h"
+#include "psf.h"
+#include "input.h"
+#include "pace.h"
+#include "anim.h"
+#include "fcache.h"
+#include "animfile.h"
+#include "stream.h"
+#include "fstore.h"
 
 #define NR_COLORS 16
 
+/* Samples taken from tslib per read; a flush covers all of them */
+#define MAX_SAMPLES 32
+
+/* Playback rate unless PARAANIM_FPS says otherwise; full-screen frames
+   go to the panel one at a time */
+#define PLAY_FPS 8
+#define PLAY_IN_FLIGHT 1
+/* Ink flushes the EPDC may work on at once while drawing */
+#define INK_IN_FLIGHT 4
+
+static double play_fps = PLAY_FPS;
+
 struct ts_button {
     int x, y, w, h;
     char *text;
@@ -57,16 +80,18 @@ enum {
 };
 static struct ts_button buttons[NR_BUTTONS];
 
-class Line {
-public:
-    Line(int x1, int y1, int x2, int y2) : x1(x1), y1(y1), x2(x2), y2(y2) {}
-    int x1, y1, x2, y2;
-};
-
-typedef std::list<Line> Drawing;
-typedef std::list<Drawing> Animation;
+/* SIGINT/SIGTERM only note the signal and wake the main loop, which
+   shuts down; close_framebuffer() takes the EPD lock and joins the
+   completion thread, which the handler cannot do safely */
+static volatile sig_atomic_t caught;
 
 static void sig(int sig)
+{
+    caught = sig;
+    input_kick();
+}
+
+static void crash(int sig)
 {
     close_framebuffer();
     fflush(stderr);
@@ -80,12 +105,10 @@ static void button_draw(struct ts_button *button)
     int s = (button->flags & BUTTON_ACTIVE) ? 3 : 0;
     rect (button->x, button->y, button->x + button->w - 1,
           button->y + button->h - 1, button_palette [s]);
-    fillrect (button->x + 1, button->y + 1,
-              button->x + button->w - 2,
-              button->y + button->h - 2, button_palette [s + 1]);
-    put_string_center (button->x + button->w / 2,
-                       button->y + button->h / 2,
-                       button->text, button_palette [s + 2]);
+    put_string_box (button->x + 1, button->y + 1,
+                    button->x + button->w - 2, button->y + button->h - 2,
+                    button->text, button_palette [s + 2],
+                    button_palette [s + 1]);
 }
 
 static int
@@ -123,7 +146,7 @@ static void refresh_screen(bool full = true)
     for (i = 0; i < NR_BUTTONS; i++)
         button_draw(&buttons [i]);
 
-    mxc_damage(0, 0, xres, yres, full ? MXC_DAMAGE_MODE_FULL : MXC_DAMAGE_MODE_MONOCHROME, true);
+    flush_screen(full ? MXC_DAMAGE_MODE_FULL : MXC_DAMAGE_MODE_MONOCHROME, true);
 }
 
 static void finalize_screen()
@@ -132,7 +155,7 @@ static void finalize_screen()
 
     fillrect(0, 0, xres - 1, yres - 1, WHITE);
 
-    mxc_damage(0, 0, xres, yres, MXC_DAMAGE_MODE_FULL, true);
+    flush_screen(MXC_DAMAGE_MODE_FULL, true);
 }
 
 static void reflect_screen(int x1, int y1, int x2, int y2, int mode)
@@ -148,47 +171,231 @@ static void reflect_screen(int x1, int y1, int x2, int y2, int mode)
     mxc_damage(x1, y1, x2 - x1 + 1, y2 - y1 + 1, mode, false);
 }
 
-static void draw_frame(const Drawing& drawing)
+/* Frames of the animation opened at start-up that have not been
+   decoded yet; they come after the ones in the arena */
+static struct animfile *file;
+static uint32_t file_loaded;
+/* Cleared when the file could not be opened or a frame of it could
+   not be read, so that saving would lose part of it */
+static bool file_intact = true;
+
+/* With a frame store only its window of frames stays in the arena;
+   the ones it spills are not kept in the frame cache either */
+static void trim_frames(struct anim& anim)
 {
-    fillrect(0, 0, xres - 1, yres - 1, WHITE);
-    for (Drawing::const_iterator it = drawing.begin(); it != drawing.end(); it++) {
-        const Line& e = *it;
-        line(e.x1, e.y1, e.x2, e.y2, BLACK);
+    uint32_t n = fstore_trim(&anim);
+
+    while (n--)
+        fcache_drop(anim.base - 1 - n);
+}
+
+/* Decode frames from the file until the animation has NR of them */
+static void load_frames(struct anim& anim, uint32_t nr)
+{
+    while (file && anim.nr_frames < nr && file_loaded < animfile_frames(file)) {
+        if (animfile_read_frame(file, file_loaded, &anim) < 0) {
+            /* keep what could be read */
+            file_loaded = animfile_frames(file);
+            file_intact = false;
+            break;
+        }
+        file_loaded++;
+        fcache_update(&anim, anim.nr_frames - 1);
+        trim_frames(anim);
+    }
+    if (file && file_loaded == animfile_frames(file)) {
+        animfile_close(file);
+        file = NULL;
     }
 }
 
-static void play(const Animation& animation, bool mono)
+/* Strokes can only be added once every frame is in the arena */
+static void load_all(struct anim& anim)
 {
+    load_frames(anim, UINT32_MAX);
+}
+
+static uint32_t total_frames(const struct anim& anim)
+{
+    return anim.nr_frames + (file ? animfile_frames(file) - file_loaded : 0);
+}
+
+/* Points of the open stroke already drawn on the screen */
+static uint32_t inked;
+/* Everything the stroke has drawn so far, for the clean-up update */
+static struct fb_rect stroke_box;
+
+/* Record a pen sample; it is only drawn by ink_stroke() */
+static void add_point(struct anim& anim, bool pen_down, int x, int y)
+{
+    if (!pen_down) {
+        load_all(anim);
+        anim_begin_stroke(&anim);
+        inked = 0;
+        stroke_box.w = 0;
+    }
+    anim_add_point(&anim, x, y);
+}
+
+/* Draw the points added since the last call as one polyline */
+static void ink_stroke(struct anim& anim)
+{
+    struct fb_rect box;
+    uint32_t n;
+    int x2, y2;
+
+    if (!anim.stroke_open)
+        return;
+    const struct point *pts = anim_stroke_points(&anim, anim.nr_strokes - 1);
+    n = anim.strokes[anim.nr_strokes - 1].count;
+
+    if (n < 2 || inked == n)
+        return;
+    if (inked == 0)
+        polyline(pts, n, BLACK, &box);
+    else
+        polyline_continue(pts + inked - 1, n - inked + 1, BLACK, &box);
+    inked = n;
+
+    if (box.w == 0)
+        return;
+    if (stroke_box.w == 0) {
+        stroke_box = box;
+        return;
+    }
+    x2 = std::max(stroke_box.x + stroke_box.w, box.x + box.w);
+    y2 = std::max(stroke_box.y + stroke_box.h, box.y + box.h);
+    stroke_box.x = std::min(stroke_box.x, box.x);
+    stroke_box.y = std::min(stroke_box.y, box.y);
+    stroke_box.w = x2 - stroke_box.x;
+    stroke_box.h = y2 - stroke_box.y;
+}
+
+/* Returns true if the stroke left ink that wants a clean-up update */
+static bool end_stroke(struct anim& anim)
+{
+    ink_stroke(anim);
+    anim_end_stroke(&anim);
+    if (stroke_box.w == 0)
+        return false;
+    /* the fast waveform leaves ghosting behind; the stroke gets one
+       quality pass over all of it, merged with any ink still pending */
+    damage_add(stroke_box.x, stroke_box.y, stroke_box.x + stroke_box.w - 1,
+               stroke_box.y + stroke_box.h - 1);
+    stroke_box.w = 0;
+    return true;
+}
+
+/* Make the drawing in progress the next frame and have it rendered
+   into the frame cache while drawing goes on */
+static void commit_frame(struct anim& anim)
+{
+    load_all(anim);
+    if (anim_commit(&anim) == 0) {
+        fcache_update(&anim, anim.nr_frames - 1);
+        trim_frames(anim);
+    }
+}
+
+static void play(struct anim& anim, bool mono)
+{
+    const struct damage_stats *ds = damage_get_stats();
+    unsigned long long pixels = ds->pixels;
+    struct pace pace;
+    uint32_t i, n;
+    int64_t shown = -1;
+
+    /* normally every frame is cached by now; anything missing or
+       changed is rendered before playback starts; spilled frames
+       are read back and drawn as they come up */
+    for (i = anim.base; i < anim.nr_frames; i++)
+        fcache_update(&anim, i);
+    fcache_sync();
+
     refresh_screen();
-    for (Animation::const_iterator it = animation.begin(); it != animation.end(); it++) {
-        draw_frame(*it);
-        mxc_damage(0, 0, xres, yres, mono ? MXC_DAMAGE_MODE_MONOCHROME: 0, true);
+    /* frames are drawn into spare framebuffer memory the EPDC updates
+       from directly, or else completed in the hidden page and flipped
+       to, so the panel never sees one half drawn; drawing keeps the
+       cheaper copy */
+    struct fb_buffer *buf = alloc_update_buffer(xres, yres);
+    if ((buf == NULL || draw_to_buffer(buf) < 0) && open_pages() < 0)
+        fprintf(stderr, "no page flipping, copying frames instead\n");
+    pace_init(&pace, play_fps, PLAY_IN_FLIGHT);
+    for (i = 0, n = total_frames(anim); i < n && !caught; i++) {
+        /* frames the panel has no time for are not even drawn */
+        if (!pace_frame(&pace, i == n - 1))
+            continue;
+        /* frames still in the file are decoded as they come up */
+        load_frames(anim, i + 1);
+        if (i >= anim.nr_frames)
+            break;
+        /* render the next frame off-screen while the previous one is
+           still being driven to the panel */
+        if (shown < 0) {
+            if (fcache_draw(i, BLACK, WHITE) < 0)
+                anim_draw_frame(&anim, i, BLACK, WHITE);
+        } else {
+            /* only what changed since the frame on the panel is redrawn,
+               which is not necessarily i - 1 once frames get dropped */
+            if (fcache_draw_delta(shown, i, BLACK, WHITE) < 0)
+                anim_draw_delta(&anim, shown, i, BLACK, WHITE);
+        }
+        shown = i;
+        pace_slot(&pace);
+        pace_submitted(&pace, flush_screen(mono ? MXC_DAMAGE_MODE_MONOCHROME: 0, false));
     }
+    pace_finish(&pace);
+    free_update_buffer(buf);
+    close_pages();
+    printf("play: %lu frames, %lu dropped, %.1f fps, %llu pixels updated\n",
+           pace.frames, pace.dropped, pace_fps(&pace), ds->pixels - pixels);
+    const struct fcache_stats *fst = fcache_get_stats();
+    printf("fcache: %lu frames in %lu bytes\n",
+           (unsigned long)fst->frames, (unsigned long)fst->bytes);
     sleep(1);
 }
 
+/* an update has finished; ink held back by the pacer may go out now */
+static void update_done(epd_marker_t marker, void *arg)
+{
+    (void)marker;
+    (void)arg;
+    input_kick();
+}
+
 int main(void)
 {
     struct tsdev *ts;
-    int x, y;
     unsigned int i;
     bool mode_pressed = false;
     bool quit_pressed = false;
+    bool commit_pending = false;
 
-    Animation animation;
-    Drawing current_drawing;
+    /* every frame and the drawing in progress */
+    struct anim anim;
 
     char *tsdevice = NULL;
+    char *fontpath;
+    char *rtprio;
+    char *fps;
+    char *path;
+    char *window, *spill;
+    struct pace ink_pace;
+    struct fbcon_font_desc *font;
+
+    anim_init(&anim);
 
-    signal(SIGSEGV, sig);
+    signal(SIGSEGV, crash);
     signal(SIGINT, sig);
     signal(SIGTERM, sig);
 
+    /* non-blocking, so that the input thread's ts_read() hands over
+       whatever has queued up instead of waiting for a full batch */
     if( (tsdevice = getenv("TSLIB_TSDEVICE")) != NULL ) {
-        ts = ts_open(tsdevice,0);
+        ts = ts_open(tsdevice,1);
     } else {
-        if (!(ts = ts_open("/dev/input/event1", 0)))
-            ts = ts_open("/dev/touchscreen/ucb1x00", 0);
+        if (!(ts = ts_open("/dev/input/event1", 1)))
+            ts = ts_open("/dev/touchscreen/ucb1x00", 1);
     }
 
     if (!ts) {
@@ -206,10 +413,46 @@ int main(void)
         exit(1);
     }
 
-    setfont(&font_vga_8x16);
+    /* draw off-screen and only push what changed to the panel */
+    open_shadow();
+    epd_start_completion_thread();
+
+    if ((fps = getenv("PARAANIM_FPS")) != NULL)
+        play_fps = atof(fps);
+    pace_init(&ink_pace, 0, INK_IN_FLIGHT);
+    epd_set_completion_callback(update_done, NULL);
+
+    /* without it playback rasterizes every frame itself */
+    if (fcache_init(xres, yres) < 0)
+        fprintf(stderr, "frame cache disabled\n");
+
+    /* PARAANIM_WINDOW=<frames> keeps only the last frames in memory,
+       spilling older ones to PARAANIM_SPILL */
+    if ((window = getenv("PARAANIM_WINDOW")) != NULL &&
+        fstore_init(&anim, (spill = getenv("PARAANIM_SPILL")) ? spill : "paraanim.spill",
+                    atoi(window)) < 0)
+        fprintf(stderr, "frame store disabled\n");
+
+    /* PARAANIM_FILE=<path> is opened at start and saved on Quit */
+    if ((path = getenv("PARAANIM_FILE")) != NULL && access(path, F_OK) == 0) {
+        if ((file = animfile_open(path)) != NULL)
+            printf("%s: %u frames\n", path, animfile_frames(file));
+        else
+            file_intact = false;
+    }
 
-    x = xres/2;
-    y = yres/2;
+    /* PARAANIM_RT=<priority> runs the input thread SCHED_FIFO */
+    if (input_start(ts, (rtprio = getenv("PARAANIM_RT")) ? atoi(rtprio) : 0) < 0) {
+        close_framebuffer();
+        exit(1);
+    }
+
+    /* a console font from the rootfs, else the built-in one */
+    if ((fontpath = getenv("PARAANIM_FONT")) == NULL ||
+        (font = psf_load(fontpath)) == NULL)
+        setfont(&font_vga_8x16);
+    else
+        setfont(font);
 
     for (i = 0; i < NR_COLORS; i++)
         setcolor(i, i * 0x111111);
@@ -233,79 +476,130 @@ int main(void)
     refresh_screen();
 
     while (1) {
-    loop:
-        struct ts_sample samp;
-        int ret;
-
-        ret = ts_read(ts, &samp, 1);
+        struct ts_sample samps[MAX_SAMPLES];
+        int ret, n;
 
+        /* samples keep arriving in the ring while play() or a waited
+           refresh holds this thread up */
+        ret = input_read(samps, MAX_SAMPLES);
         if (ret < 0) {
-            perror("ts_read");
+            /* the input thread has said why */
+            input_stop();
             close_framebuffer();
             exit(1);
         }
 
-        if (ret != 1)
-            continue;
-
-        bool dirty = true;
-
-        for (i = 0; i < NR_BUTTONS; i++) {
-            if (button_handle(&buttons[i], &samp)) {
-                switch (i) {
-                case BUTTON_PLAY:
-                    if (!current_drawing.empty())
-                        animation.push_back(current_drawing);
-                    play(animation, false);
-                    current_drawing.clear();
-                    refresh_screen();
-                    dirty = false;
-                    break;
-                case BUTTON_PLAY_MONOCHROME:
-                    if (!current_drawing.empty())
-                        animation.push_back(current_drawing);
-                    play(animation, true);
-                    current_drawing.clear();
-                    refresh_screen();
-                    dirty = false;
-                    break;
-                case BUTTON_NEXT:
-                    animation.push_back(current_drawing);
-                    current_drawing.clear();
-                    refresh_screen(false);
-                    dirty = false;
-                    break;
-                case BUTTON_CLEAR:
-                    current_drawing.clear();
-                    refresh_screen();
-                    dirty = false;
-                    break;
-                case BUTTON_QUIT:
-                    quit_pressed = true;
+        /* Handle the whole batch, then draw the new part of the stroke
+           as one polyline and flush once */
+        for (n = 0; n < ret; n++) {
+            struct ts_sample& samp = samps[n];
+
+            for (i = 0; i < NR_BUTTONS; i++) {
+                if (button_handle(&buttons[i], &samp)) {
+                    switch (i) {
+                    case BUTTON_PLAY:
+                        if (anim_current(&anim).count)
+                            commit_frame(anim);
+                        play(anim, false);
+                        refresh_screen();
+                        break;
+                    case BUTTON_PLAY_MONOCHROME:
+                        if (anim_current(&anim).count)
+                            commit_frame(anim);
+                        play(anim, true);
+                        refresh_screen();
+                        break;
+                    case BUTTON_NEXT:
+                        commit_frame(anim);
+                        refresh_screen(false);
+                        break;
+                    case BUTTON_CLEAR:
+                        anim_discard(&anim);
+                        refresh_screen();
+                        break;
+                    case BUTTON_QUIT:
+                        quit_pressed = true;
+                    }
                 }
             }
-        }
 
-        /*printf("%ld.%06ld: %6d %6d %6d\n", samp.tv.tv_sec, samp.tv.tv_usec,
-                 samp.x, samp.y, samp.pressure);*/
+            /*printf("%ld.%06ld: %6d %6d %6d\n", samp.tv.tv_sec, samp.tv.tv_usec,
+                     samp.x, samp.y, samp.pressure);*/
 
-        if (samp.pressure > 0 && samp.y > (buttons[0].y + buttons[0].h)) {
-            if (mode_pressed) {
-                line(x, y, samp.x, samp.y, BLACK);
-                current_drawing.push_back(Line(x, y, samp.x, samp.y));
+            if (samp.pressure > 0 && samp.y > (buttons[0].y + buttons[0].h)) {
+                add_point(anim, mode_pressed, samp.x, samp.y);
+                mode_pressed = true;
+            } else {
+                if (mode_pressed && end_stroke(anim))
+                    commit_pending = true;
+                mode_pressed = false;
             }
-            x = samp.x;
-            y = samp.y;
-            mode_pressed = true;
-        } else
-            mode_pressed = false;
-
-        if (dirty)
-            mxc_damage(0, 0, xres, yres, MXC_DAMAGE_MODE_MONOCHROME, false);
-        if (quit_pressed)
+        }
+        if (mode_pressed)
+            ink_stroke(anim);
+
+        /* with the EPDC busy, ink keeps collecting as damage and goes
+           out in one update once one of ours completes.  While the pen
+           is down only the new segments go out, with A2; a finished
+           stroke goes out once more as a full update with the automatic
+           waveform, since a partial one would only drive the pixels
+           that changed and leave the A2 ghosting where it is */
+        if (damage_pending() && pace_ready(&ink_pace)) {
+            pace_submitted(&ink_pace, flush_screen(commit_pending ? MXC_DAMAGE_MODE_FULL : MXC_DAMAGE_MODE_MONOCHROME, false));
+            commit_pending = false;
+        }
+        if (quit_pressed || caught)
             break;
+        if (ret == 0)
+            input_wait(-1);
+    }
+    input_stop();
+    if (caught) {
+        close_framebuffer();
+        fflush(stderr);
+        printf("signal %d caught\n", (int)caught);
+        fflush(stdout);
+        exit(1);
     }
+    if (path != NULL) {
+        load_all(anim);
+        /* never replace a file that was only partly read */
+        std::string out = path;
+        if (!file_intact)
+            out += ".new";
+        if (animfile_save(out.c_str(), &anim) == 0)
+            printf("%s: %u frames saved\n", out.c_str(), anim.nr_frames);
+    }
+    /* PARAANIM_EXPORT=<path> writes the frames pre-rasterized for
+       paraplay, at PARAANIM_EXPORT_DEPTH (1 or 4) bits per pixel */
+    if ((path = getenv("PARAANIM_EXPORT")) != NULL) {
+        load_all(anim);
+        char *depth = getenv("PARAANIM_EXPORT_DEPTH");
+        if (stream_export(path, &anim, xres, yres, depth ? atoi(depth) : 1) == 0)
+            printf("%s: %u frames exported\n", path, anim.nr_frames);
+    }
+    animfile_close(file);
+    fcache_exit();
+    const struct fstore_stats *sst = fstore_get_stats(&anim);
+    fstore_exit(&anim);
     finalize_screen();
     close_framebuffer();
+
+    const struct damage_stats *st = damage_get_stats();
+    printf("damage: %lu flushes, %lu updates (%lu full screen), %llu pixels\n",
+           st->flushes, st->updates, st->full_updates, st->pixels);
+    const struct input_stats *ist = input_get_stats();
+    printf("input: %lu samples, %lu dropped, %lu max queued, %lu us max latency\n",
+           ist->samples, ist->dropped, ist->max_queued, ist->max_latency_us);
+    printf("anim: %u frames (%u in memory), %u strokes, %u points in %lu bytes\n",
+           anim.nr_frames, anim.nr_frames - anim.base, anim.nr_strokes, anim.nr_points,
+           (unsigned long)anim_bytes(&anim));
+    if (window != NULL)
+        printf("fstore: %lu spills, %lu faults, %llu bytes spilled, %lu bytes resident\n",
+               sst->spills, sst->faults, sst->spilled, (unsigned long)sst->resident);
+    const struct fcache_stats *fst = fcache_get_stats();
+    printf("fcache: %lu rendered, %lu invalidated, %lu hits, %lu misses\n",
+           fst->rendered, fst->invalidated, fst->hits, fst->misses);
+    anim_free(&anim);
     return 0;
 }
@@ -0,0 +1,96 @@
+/*
+ * paraplay.c
+ *
+ * Streaming player for animations exported by paraanim
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ *
+ * Usage: paraplay file [fps]
+ *
+ * Plays a file written with PARAANIM_EXPORT.  Frames are read from the
+ * file as they come up and only their changed rectangles are copied to
+ * the screen, so memory use does not grow with the animation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fbutils.h"
+#include "epd.h"
+#include "pace.h"
+#include "stream.h"
+
+#define BLACK 0
+#define WHITE 15
+
+int main(int argc, char **argv)
+{
+	unsigned palette [16];
+	const struct stream_stats *st;
+	struct stream *s;
+	struct fb_buffer *buf;
+	struct pace pace;
+	uint32_t i, n;
+	int r = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s file [fps]\n", argv[0]);
+		return 1;
+	}
+	s = stream_open(argv[1]);
+	if (s == NULL)
+		return 1;
+
+	if (open_framebuffer()) {
+		close_framebuffer();
+		stream_close(s);
+		return 1;
+	}
+	open_shadow();
+	/* frames go into memory the EPDC updates from directly, or are
+	   flipped to; either way the panel never picks up a frame that is
+	   only partly drawn */
+	buf = alloc_update_buffer(xres, yres);
+	if (buf == NULL || draw_to_buffer(buf) < 0)
+		open_pages();
+	epd_start_completion_thread();
+	for (i = 0; i < 16; i++) {
+		setcolor(i, i * 0x111111);
+		palette [i] = i;
+	}
+	if (stream_depth(s) == 1) {
+		palette [0] = WHITE;
+		palette [1] = BLACK;
+	}
+
+	fillrect(0, 0, xres - 1, yres - 1, WHITE);
+	flush_screen(MXC_DAMAGE_MODE_FULL, 1);
+
+	pace_init(&pace, argc > 2 ? atof(argv[2]) : 8, 1);
+	for (i = 0, n = stream_frames(s); i < n; i++) {
+		/* a dropped frame is still drawn, as the next one only
+		   holds what changed since; it just never gets an update */
+		r = stream_next(s, palette);
+		if (r <= 0)
+			break;
+		if (!pace_frame(&pace, i == n - 1))
+			continue;
+		pace_slot(&pace);
+		pace_submitted(&pace, flush_screen(0, 0));
+	}
+	pace_finish(&pace);
+
+	st = stream_get_stats(s);
+	printf("%lu frames, %lu dropped, %.1f fps\n",
+	       pace.frames, pace.dropped, pace_fps(&pace));
+	printf("stream: %llu bytes read, %lu byte frame buffer\n",
+	       st->bytes, (unsigned long)st->buffer);
+
+	stream_close(s);
+	close_framebuffer();
+	return r < 0;
+}
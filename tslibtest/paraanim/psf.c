@@ -0,0 +1,309 @@
+/*
+ * psf.c
+ *
+ * Console fonts (PSF1/PSF2) mapped from files at run time
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "psf.h"
+#include "glyph.h"
+
+#define PSF1_MAGIC0	0x36
+#define PSF1_MAGIC1	0x04
+#define PSF1_MODE512	0x01
+#define PSF1_MODEHASTAB	0x02
+#define PSF1_MODEHASSEQ	0x04
+#define PSF1_SEPARATOR	0xffff
+#define PSF1_STARTSEQ	0xfffe
+
+#define PSF2_MAGIC	0x864ab572
+#define PSF2_HAS_UNICODE_TABLE 0x01
+#define PSF2_SEPARATOR	0xff
+#define PSF2_STARTSEQ	0xfe
+
+/* The glyph cache stores run offsets in a byte */
+#define PSF_MAX_SIZE	255
+
+struct psf_font {
+	struct fbcon_font_desc desc;	/* must be first */
+	struct font_map map;
+	void *base;
+	size_t length;
+};
+
+/* Growable list of (ucs, glyph) pairs while reading a Unicode table */
+struct map_builder {
+	struct font_map_entry *entries;
+	unsigned nr, size;
+};
+
+static __u32 get32(const unsigned char *p)
+{
+	return p [0] | p [1] << 8 | p [2] << 16 | (__u32)p [3] << 24;
+}
+
+static int map_add(struct map_builder *b, __u32 ucs, __u32 glyph)
+{
+	if (b->nr == b->size) {
+		unsigned size = b->size ? b->size * 2 : 256;
+		struct font_map_entry *e = realloc(b->entries, size * sizeof(*e));
+		if (e == NULL)
+			return -1;
+		b->entries = e;
+		b->size = size;
+	}
+	b->entries [b->nr].ucs = ucs;
+	b->entries [b->nr].glyph = glyph;
+	b->nr++;
+	return 0;
+}
+
+/* Decode one UTF-8 sequence; returns its length, 0 if malformed */
+static int utf8_get(const unsigned char *p, const unsigned char *end, __u32 *ucs)
+{
+	int n, i;
+	__u32 c = *p;
+
+	if (c < 0x80) { *ucs = c; return 1; }
+	else if ((c & 0xe0) == 0xc0) { n = 2; c &= 0x1f; }
+	else if ((c & 0xf0) == 0xe0) { n = 3; c &= 0x0f; }
+	else if ((c & 0xf8) == 0xf0) { n = 4; c &= 0x07; }
+	else return 0;
+
+	if (end - p < n)
+		return 0;
+	for (i = 1; i < n; i++) {
+		if ((p [i] & 0xc0) != 0x80)
+			return 0;
+		c = c << 6 | (p [i] & 0x3f);
+	}
+	*ucs = c;
+	return n;
+}
+
+/* Sequences (combining characters) are skipped: only single code
+ * points are mapped. */
+static int read_psf1_table(struct map_builder *b, const unsigned char *p,
+			   const unsigned char *end, unsigned charcount)
+{
+	unsigned glyph = 0, v;
+	int seq = 0;
+
+	for (; p + 2 <= end && glyph < charcount; p += 2) {
+		v = p [0] | p [1] << 8;
+		if (v == PSF1_SEPARATOR) {
+			glyph++;
+			seq = 0;
+		} else if (v == PSF1_STARTSEQ) {
+			seq = 1;
+		} else if (!seq && map_add(b, v, glyph) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int read_psf2_table(struct map_builder *b, const unsigned char *p,
+			   const unsigned char *end, unsigned charcount)
+{
+	unsigned glyph = 0;
+	int n, seq = 0;
+	__u32 ucs;
+
+	while (p < end && glyph < charcount) {
+		if (*p == PSF2_SEPARATOR) {
+			glyph++;
+			seq = 0;
+			p++;
+		} else if (*p == PSF2_STARTSEQ) {
+			seq = 1;
+			p++;
+		} else if ((n = utf8_get(p, end, &ucs)) == 0) {
+			p++;
+		} else {
+			if (!seq && map_add(b, ucs, glyph) < 0)
+				return -1;
+			p += n;
+		}
+	}
+	return 0;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct font_map_entry *x = a, *y = b;
+
+	if (x->ucs != y->ucs)
+		return x->ucs < y->ucs ? -1 : 1;
+	return x->glyph < y->glyph ? -1 : x->glyph > y->glyph;
+}
+
+/* Sort the table, keep the first glyph for each code point and move
+ * the ones below 256 to the direct lookup */
+static void map_finish(struct font_map *map, struct map_builder *b)
+{
+	unsigned i, n = 0;
+
+	memset(map->direct, 0xff, sizeof(map->direct));
+	qsort(b->entries, b->nr, sizeof(*b->entries), entry_cmp);
+	for (i = 0; i < b->nr; i++) {
+		if (n > 0 && b->entries [n - 1].ucs == b->entries [i].ucs)
+			continue;
+		if (b->entries [i].ucs < 256)
+			map->direct [b->entries [i].ucs] = b->entries [i].glyph;
+		b->entries [n++] = b->entries [i];
+	}
+	map->entries = b->entries;
+	map->nr_entries = n;
+}
+
+static int psf_parse(struct psf_font *f)
+{
+	const unsigned char *p = f->base, *end = p + f->length;
+	struct map_builder b = { NULL, 0, 0 };
+	unsigned charcount, charsize, width, height, offset;
+	int psf1, has_table, r;
+
+	psf1 = f->length >= 4 && p [0] == PSF1_MAGIC0 && p [1] == PSF1_MAGIC1;
+	if (psf1) {
+		charcount = (p [2] & PSF1_MODE512) ? 512 : 256;
+		charsize = height = p [3];
+		width = 8;
+		offset = 4;
+		has_table = (p [2] & (PSF1_MODEHASTAB | PSF1_MODEHASSEQ)) != 0;
+	} else if (f->length >= 32 && get32(p) == PSF2_MAGIC) {
+		offset = get32(p + 8);
+		has_table = (get32(p + 12) & PSF2_HAS_UNICODE_TABLE) != 0;
+		charcount = get32(p + 16);
+		charsize = get32(p + 20);
+		height = get32(p + 24);
+		width = get32(p + 28);
+	} else {
+		return -1;
+	}
+
+	if (width == 0 || height == 0 || charcount == 0 || charcount >= 0xffff ||
+	    width > PSF_MAX_SIZE || height > PSF_MAX_SIZE ||
+	    charsize != height * ((width + 7) / 8) ||
+	    offset > f->length ||
+	    (f->length - offset) / charsize < charcount)
+		return -1;
+
+	f->desc.idx = PSF_IDX;
+	f->desc.width = width;
+	f->desc.height = height;
+	f->desc.data = (const char *)p + offset;
+	f->desc.charcount = charcount;
+	f->desc.map = NULL;
+	if (!has_table)
+		return 0;
+
+	p += offset + charcount * charsize;
+	if (psf1)
+		r = read_psf1_table(&b, p, end, charcount);
+	else
+		r = read_psf2_table(&b, p, end, charcount);
+	if (r < 0) {
+		free(b.entries);
+		return -1;
+	}
+	map_finish(&f->map, &b);
+	f->desc.map = &f->map;
+	return 0;
+}
+
+struct fbcon_font_desc *psf_load(const char *path)
+{
+	struct psf_font *f;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(path);
+		close(fd);
+		return NULL;
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (f == NULL || (f->desc.name = strdup(path)) == NULL) {
+		perror("psf_load");
+		free(f);
+		close(fd);
+		return NULL;
+	}
+	f->length = st.st_size;
+	f->base = mmap(NULL, f->length, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (f->base == MAP_FAILED) {
+		perror(path);
+		free(f->desc.name);
+		free(f);
+		return NULL;
+	}
+
+	if (psf_parse(f) < 0) {
+		fprintf(stderr, "%s: not a PSF font\n", path);
+		munmap(f->base, f->length);
+		free(f->desc.name);
+		free(f);
+		return NULL;
+	}
+	return &f->desc;
+}
+
+void psf_free(struct fbcon_font_desc *font)
+{
+	struct psf_font *f = (struct psf_font *)font;
+
+	if (font == NULL)
+		return;
+	glyph_flush(font);
+	munmap(f->base, f->length);
+	free(f->map.entries);
+	free(f->desc.name);
+	free(f);
+}
+
+unsigned font_glyph(const struct fbcon_font_desc *font, unsigned ucs)
+{
+	const struct font_map *map = font->map;
+	unsigned lo, hi, mid;
+
+	if (map == NULL)
+		return ucs % font_charcount(font);
+
+	if (ucs < 256 && map->direct [ucs] != 0xffff)
+		return map->direct [ucs];
+	if (ucs >= 256) {
+		lo = 0;
+		hi = map->nr_entries;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (map->entries [mid].ucs < ucs)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo < map->nr_entries && map->entries [lo].ucs == ucs)
+			return map->entries [lo].glyph;
+	}
+	return map->direct ['?'] != 0xffff ? map->direct ['?'] : 0;
+}
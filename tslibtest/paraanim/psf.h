@@ -0,0 +1,61 @@
+/*
+ * psf.h
+ *
+ * Console fonts (PSF1/PSF2) mapped from files at run time
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _PSF_H
+#define _PSF_H
+
+#include "font.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct font_map_entry {
+	__u32 ucs;
+	__u32 glyph;
+};
+
+/* Unicode table of a PSF font: characters below 256 are looked up
+ * directly, the rest by binary search in ENTRIES (sorted by ucs).
+ */
+struct font_map {
+	unsigned short direct [256];	/* 0xffff if not in the font */
+	unsigned nr_entries;
+	struct font_map_entry *entries;
+};
+
+/* Map the PSF1 or PSF2 font at PATH read-only.  The glyph bitmaps stay
+ * in the page cache, shared with every other process using the font.
+ * Returns NULL (with a message on stderr) if the file is not a usable
+ * font.
+ */
+struct fbcon_font_desc *psf_load(const char *path);
+
+/* Unmap a font from psf_load; it must no longer be the current font */
+void psf_free(struct fbcon_font_desc *font);
+
+/* Glyph index for character UCS in FONT.  Fonts without a Unicode
+ * table are indexed by the character code directly.
+ */
+unsigned font_glyph(const struct fbcon_font_desc *font, unsigned ucs);
+
+/* Number of glyphs in FONT */
+static inline unsigned font_charcount(const struct fbcon_font_desc *font)
+{
+	return font->charcount ? font->charcount : 256;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PSF_H */
@@ -0,0 +1,470 @@
+/*
+ * raster.c
+ *
+ * Per-pixel-format raster backends used by fbutils
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RASTER_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RASTER_SSE2
+#endif
+
+#include "raster.h"
+
+/* Wide span engine.  A span is handled as a run of bytes filled with a
+ * 32-bit pattern holding the color replicated for the pixel size, so
+ * byte k of the pattern belongs at any address congruent to k mod 4.
+ * The ragged head is written bytewise up to a 16-byte boundary, the
+ * body with 16-byte vector stores and the tail bytewise again.
+ */
+static void span_fill(unsigned char *p, size_t len, uint32_t pattern)
+{
+	const unsigned char *pb = (const unsigned char *)&pattern;
+
+	for (; len && ((uintptr_t)p & 15); len--, p++)
+		*p = pb [(uintptr_t)p & 3];
+
+#if defined(RASTER_NEON)
+	{
+		uint32x4_t v = vdupq_n_u32(pattern);
+		for (; len >= 16; len -= 16, p += 16)
+			vst1q_u32((uint32_t *)p, v);
+	}
+#elif defined(RASTER_SSE2)
+	{
+		__m128i v = _mm_set1_epi32(pattern);
+		for (; len >= 16; len -= 16, p += 16)
+			_mm_store_si128((__m128i *)p, v);
+	}
+#else
+	for (; len >= 4; len -= 4, p += 4)
+		*(uint32_t *)p = pattern;
+#endif
+
+	for (; len; len--, p++)
+		*p = pb [(uintptr_t)p & 3];
+}
+
+static void span_xor(unsigned char *p, size_t len, uint32_t pattern)
+{
+	const unsigned char *pb = (const unsigned char *)&pattern;
+
+	for (; len && ((uintptr_t)p & 15); len--, p++)
+		*p ^= pb [(uintptr_t)p & 3];
+
+#if defined(RASTER_NEON)
+	{
+		uint32x4_t v = vdupq_n_u32(pattern);
+		for (; len >= 16; len -= 16, p += 16)
+			vst1q_u32((uint32_t *)p,
+				  veorq_u32(vld1q_u32((uint32_t *)p), v));
+	}
+#elif defined(RASTER_SSE2)
+	{
+		__m128i v = _mm_set1_epi32(pattern);
+		for (; len >= 16; len -= 16, p += 16)
+			_mm_store_si128((__m128i *)p,
+					_mm_xor_si128(_mm_load_si128((__m128i *)p), v));
+	}
+#else
+	for (; len >= 4; len -= 4, p += 4)
+		*(uint32_t *)p ^= pattern;
+#endif
+
+	for (; len; len--, p++)
+		*p ^= pb [(uintptr_t)p & 3];
+}
+
+/* Clip a segment against a w x h surface in parameter space: find the
+ * range of Bresenham steps whose pixels are visible instead of moving the
+ * endpoints, so the pixels drawn are exactly those the unclipped line
+ * would have drawn inside the surface.  With SKIP_FIRST the pixel at
+ * (x1, y1) is left out, for joining segments without overdraw.
+ * Returns 0 when nothing is visible.
+ */
+int raster_clip_line(int x1, int y1, int x2, int y2, int w, int h,
+		     int skip_first, struct raster_line *l)
+{
+	int dx = x2 - x1, dy = y2 - y1;
+	int xmajor = abs(dx) >= abs(dy);
+	int a1, b1, sa, sb, na, nb, alim, blim;
+	long long kmin, kmax, mlo, mhi, num, m;
+
+	/* Trivial reject, both ends beyond the same edge */
+	if ((x1 < 0 && x2 < 0) || (x1 >= w && x2 >= w) ||
+	    (y1 < 0 && y2 < 0) || (y1 >= h && y2 >= h))
+		return 0;
+
+	/* Work in major (a) and minor (b) axis terms */
+	a1 = xmajor ? x1 : y1;
+	b1 = xmajor ? y1 : x1;
+	sa = (xmajor ? dx : dy) < 0 ? -1 : 1;
+	sb = (xmajor ? dy : dx) < 0 ? -1 : 1;
+	na = abs(xmajor ? dx : dy);
+	nb = abs(xmajor ? dy : dx);
+	alim = xmajor ? w : h;
+	blim = xmajor ? h : w;
+
+	/* Steps k in [kmin, kmax] keep a = a1 + sa * k on the surface */
+	kmin = skip_first ? 1 : 0;
+	kmax = na;
+	if (sa > 0) {
+		if (-a1 > kmin) kmin = -a1;
+		if (alim - 1 - a1 < kmax) kmax = alim - 1 - a1;
+	} else {
+		if (a1 - (alim - 1) > kmin) kmin = a1 - (alim - 1);
+		if (a1 < kmax) kmax = a1;
+	}
+
+	/* The minor offset m(k) = floor((2k nb + na) / 2na) must stay within
+	 * [mlo, mhi] to keep b = b1 + sb * m on the surface too */
+	if (sb > 0) {
+		mlo = -b1;
+		mhi = blim - 1 - b1;
+	} else {
+		mlo = b1 - (blim - 1);
+		mhi = b1;
+	}
+	if (mhi < 0 || mlo > nb)
+		return 0;
+	if (nb > 0) {
+		if (mlo > 0) {
+			num = 2LL * na * mlo - na;
+			if ((num + 2LL * nb - 1) / (2LL * nb) > kmin)
+				kmin = (num + 2LL * nb - 1) / (2LL * nb);
+		}
+		if (mhi < nb) {
+			num = 2LL * na * (mhi + 1) - na - 1;
+			if (num / (2LL * nb) < kmax)
+				kmax = num / (2LL * nb);
+		}
+	}
+
+	if (kmin > kmax)
+		return 0;
+
+	if (na > 0) {
+		num = 2LL * kmin * nb + na;
+		m = num / (2LL * na);
+		l->err = num % (2LL * na);
+	} else {
+		m = 0;
+		l->err = 0;
+	}
+	l->inc = 2 * nb;
+	l->mod = 2 * na;
+	l->n = kmax - kmin + 1;
+	l->xmajor = xmajor;
+	if (xmajor) {
+		l->x = a1 + sa * kmin;
+		l->y = b1 + sb * m;
+		l->sx = sa;
+		l->sy = sb;
+	} else {
+		l->x = b1 + sb * m;
+		l->y = a1 + sa * kmin;
+		l->sx = sb;
+		l->sy = sa;
+	}
+	return 1;
+}
+
+/* Bresenham walk over a clipped segment, plotting with PLOT(row, x,
+ * color); no bounds checks inside. */
+#define RASTER_LINE(fname, PLOT)					\
+static void fname(unsigned char **rows, const struct raster_line *l,	\
+		  unsigned color)					\
+{									\
+	int x = l->x, y = l->y, err = l->err, n = l->n;			\
+									\
+	if (l->xmajor) {						\
+		for (; n--; x += l->sx) {				\
+			PLOT(rows [y], x, color);			\
+			if ((err += l->inc) >= l->mod) {		\
+				err -= l->mod;				\
+				y += l->sy;				\
+			}						\
+		}							\
+	} else {							\
+		for (; n--; y += l->sy) {				\
+			PLOT(rows [y], x, color);			\
+			if ((err += l->inc) >= l->mod) {		\
+				err -= l->mod;				\
+				x += l->sx;				\
+			}						\
+		}							\
+	}								\
+}
+
+/* Stamp out the copy and XOR variants of a backend for one pixel type,
+ * so that none of the inner loops has to look at the format or mode.
+ * PATTERN replicates a color value over 32 bits for the span engine.
+ */
+#define RASTER_BACKEND(name, type, bpp, PATTERN)			\
+static void name##_pixel_copy(unsigned char *row, int x, unsigned color) \
+{									\
+	((type *)row)[x] = color;					\
+}									\
+									\
+static void name##_pixel_xor(unsigned char *row, int x, unsigned color)	\
+{									\
+	((type *)row)[x] ^= color;					\
+}									\
+									\
+static void name##_hspan_copy(unsigned char *row, int x, int n,	\
+			      unsigned color)				\
+{									\
+	span_fill(row + x * sizeof(type), n * sizeof(type),		\
+		  PATTERN(color));					\
+}									\
+									\
+static void name##_hspan_xor(unsigned char *row, int x, int n,		\
+			     unsigned color)				\
+{									\
+	span_xor(row + x * sizeof(type), n * sizeof(type),		\
+		 PATTERN(color));					\
+}									\
+									\
+static void name##_vspan_copy(unsigned char *row, int stride, int x,	\
+			      int n, unsigned color)			\
+{									\
+	for (row += x * sizeof(type); n--; row += stride)		\
+		*(type *)row = color;					\
+}									\
+									\
+static void name##_vspan_xor(unsigned char *row, int stride, int x,	\
+			     int n, unsigned color)			\
+{									\
+	for (row += x * sizeof(type); n--; row += stride)		\
+		*(type *)row ^= color;					\
+}									\
+									\
+RASTER_LINE(name##_line_copy, name##_pixel_copy)			\
+RASTER_LINE(name##_line_xor, name##_pixel_xor)				\
+									\
+static void name##_copy_row(unsigned char *dst, int dx,		\
+			    const unsigned char *src, int sx, int n)	\
+{									\
+	memcpy(dst + dx * sizeof(type), src + sx * sizeof(type),	\
+		n * sizeof(type));					\
+}									\
+									\
+static const struct raster_ops name##_copy = {				\
+	bpp, name##_pixel_copy, name##_hspan_copy, name##_vspan_copy,	\
+	name##_line_copy, name##_copy_row				\
+};									\
+static const struct raster_ops name##_xor = {				\
+	bpp, name##_pixel_xor, name##_hspan_xor, name##_vspan_xor,	\
+	name##_line_xor, name##_copy_row				\
+};
+
+#define PATTERN8(c)	(((c) & 0xff) * 0x01010101u)
+#define PATTERN16(c)	(((c) & 0xffff) * 0x00010001u)
+#define PATTERN32(c)	((uint32_t)(c))
+
+RASTER_BACKEND(y8, uint8_t, 8, PATTERN8)
+RASTER_BACKEND(rgb565, uint16_t, 16, PATTERN16)
+RASTER_BACKEND(rgb32, uint32_t, 32, PATTERN32)
+
+/* Packed formats below 8 bpp hold 8 / bpp pixels per byte, the leftmost
+ * in the most significant bits as on the EPDC's Y1/Y2/Y4 framebuffers.
+ * A span covers a run of whole bytes, which go through the span engine
+ * with the color replicated over all of them, and at most one partial
+ * byte at either end, which is merged in under a mask.  So a full row
+ * writes xres * bpp / 8 bytes, a quarter or half of what Y8 writes.
+ */
+#define PACKED_MASK(bpp)	((1u << (bpp)) - 1)
+#define PACKED_SHIFT(bpp, x)	(8 - (bpp) - ((x) * (bpp) & 7))
+
+/* Bits B0 up to (not including) B1 of a byte, counting from the MSB */
+static unsigned bit_mask(int b0, int b1)
+{
+	return (0xffu >> b0) & ~(0xffu >> b1);
+}
+
+static void packed_span(unsigned char *row, int bpp, int x, int n,
+			uint32_t pattern, int xormode)
+{
+	unsigned char *p = row + (x * bpp >> 3);
+	int b0 = x * bpp & 7, len = (b0 + n * bpp) >> 3, b1 = (b0 + n * bpp) & 7;
+	unsigned mask;
+
+	if (len == 0) {
+		mask = bit_mask(b0, b1);
+		if (xormode)
+			*p ^= pattern & mask;
+		else
+			*p = (*p & ~mask) | (pattern & mask);
+		return;
+	}
+	if (b0) {
+		mask = bit_mask(b0, 8);
+		if (xormode)
+			*p ^= pattern & mask;
+		else
+			*p = (*p & ~mask) | (pattern & mask);
+		p++;
+		len--;
+	}
+	if (xormode)
+		span_xor(p, len, pattern);
+	else
+		span_fill(p, len, pattern);
+	p += len;
+	if (b1) {
+		mask = bit_mask(0, b1);
+		if (xormode)
+			*p ^= pattern & mask;
+		else
+			*p = (*p & ~mask) | (pattern & mask);
+	}
+}
+
+/* Copy N pixels from pixel SX of SRC to pixel DX of DST.  When both
+ * start at the same bit within a byte, the whole bytes in between are
+ * copied as they are; otherwise pixel by pixel. */
+static void packed_copy_row(unsigned char *dst, int dx, const unsigned char *src,
+			    int sx, int n, int bpp)
+{
+	int b0 = dx * bpp & 7, len, b1, s, d;
+	unsigned mask, v;
+
+	if (b0 != (sx * bpp & 7)) {
+		for (; n--; sx++, dx++) {
+			v = src [sx * bpp >> 3] >> PACKED_SHIFT(bpp, sx);
+			s = PACKED_SHIFT(bpp, dx);
+			d = dx * bpp >> 3;
+			dst [d] = (dst [d] & ~(PACKED_MASK(bpp) << s)) |
+				  (v & PACKED_MASK(bpp)) << s;
+		}
+		return;
+	}
+
+	dst += dx * bpp >> 3;
+	src += sx * bpp >> 3;
+	len = (b0 + n * bpp) >> 3;
+	b1 = (b0 + n * bpp) & 7;
+	if (len == 0) {
+		mask = bit_mask(b0, b1);
+		*dst = (*dst & ~mask) | (*src & mask);
+		return;
+	}
+	if (b0) {
+		mask = bit_mask(b0, 8);
+		*dst = (*dst & ~mask) | (*src & mask);
+		dst++;
+		src++;
+		len--;
+	}
+	memcpy(dst, src, len);
+	if (b1) {
+		mask = bit_mask(0, b1);
+		dst [len] = (dst [len] & ~mask) | (src [len] & mask);
+	}
+}
+
+#define RASTER_PACKED(name, bpp, PATTERN)				\
+static void name##_pixel_copy(unsigned char *row, int x, unsigned color) \
+{									\
+	unsigned char *p = row + (x * (bpp) >> 3);			\
+	int s = PACKED_SHIFT(bpp, x);					\
+									\
+	*p = (*p & ~(PACKED_MASK(bpp) << s)) |				\
+	     (color & PACKED_MASK(bpp)) << s;				\
+}									\
+									\
+static void name##_pixel_xor(unsigned char *row, int x, unsigned color)	\
+{									\
+	row [x * (bpp) >> 3] ^= (color & PACKED_MASK(bpp)) <<		\
+				 PACKED_SHIFT(bpp, x);			\
+}									\
+									\
+static void name##_hspan_copy(unsigned char *row, int x, int n,	\
+			      unsigned color)				\
+{									\
+	packed_span(row, bpp, x, n, PATTERN(color), 0);			\
+}									\
+									\
+static void name##_hspan_xor(unsigned char *row, int x, int n,		\
+			     unsigned color)				\
+{									\
+	packed_span(row, bpp, x, n, PATTERN(color), 1);			\
+}									\
+									\
+static void name##_vspan_copy(unsigned char *row, int stride, int x,	\
+			      int n, unsigned color)			\
+{									\
+	int s = PACKED_SHIFT(bpp, x);					\
+	unsigned mask = PACKED_MASK(bpp) << s;				\
+	unsigned v = (color & PACKED_MASK(bpp)) << s;			\
+									\
+	for (row += x * (bpp) >> 3; n--; row += stride)			\
+		*row = (*row & ~mask) | v;				\
+}									\
+									\
+static void name##_vspan_xor(unsigned char *row, int stride, int x,	\
+			     int n, unsigned color)			\
+{									\
+	unsigned v = (color & PACKED_MASK(bpp)) << PACKED_SHIFT(bpp, x); \
+									\
+	for (row += x * (bpp) >> 3; n--; row += stride)			\
+		*row ^= v;						\
+}									\
+									\
+RASTER_LINE(name##_line_copy, name##_pixel_copy)			\
+RASTER_LINE(name##_line_xor, name##_pixel_xor)				\
+									\
+static void name##_copy_row(unsigned char *dst, int dx,		\
+			    const unsigned char *src, int sx, int n)	\
+{									\
+	packed_copy_row(dst, dx, src, sx, n, bpp);			\
+}									\
+									\
+static const struct raster_ops name##_copy = {				\
+	bpp, name##_pixel_copy, name##_hspan_copy, name##_vspan_copy,	\
+	name##_line_copy, name##_copy_row				\
+};									\
+static const struct raster_ops name##_xor = {				\
+	bpp, name##_pixel_xor, name##_hspan_xor, name##_vspan_xor,	\
+	name##_line_xor, name##_copy_row				\
+};
+
+#define PATTERN1(c)	(((c) & 0x1) * 0xffffffffu)
+#define PATTERN2(c)	(((c) & 0x3) * 0x55555555u)
+#define PATTERN4(c)	(((c) & 0xf) * 0x11111111u)
+
+RASTER_PACKED(y1, 1, PATTERN1)
+RASTER_PACKED(y2, 2, PATTERN2)
+RASTER_PACKED(y4, 4, PATTERN4)
+
+const struct raster_ops *raster_select(int bits_per_pixel, int xormode)
+{
+	switch (bits_per_pixel) {
+	case 1:
+		return xormode ? &y1_xor : &y1_copy;
+	case 2:
+		return xormode ? &y2_xor : &y2_copy;
+	case 4:
+		return xormode ? &y4_xor : &y4_copy;
+	case 8:
+	default:
+		return xormode ? &y8_xor : &y8_copy;
+	case 16:
+		return xormode ? &rgb565_xor : &rgb565_copy;
+	case 32:
+		return xormode ? &rgb32_xor : &rgb32_copy;
+	}
+}
@@ -0,0 +1,63 @@
+/*
+ * raster.h
+ *
+ * Per-pixel-format raster backends used by fbutils
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _RASTER_H
+#define _RASTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A line segment after clipping, ready for an unchecked Bresenham walk.
+ * (x, y) is the first visible pixel and n the number of pixels to plot.
+ * Each step advances the major axis by one; the error term err grows by
+ * inc and, when it reaches mod, the minor axis advances too.
+ */
+struct raster_line {
+	int x, y;
+	int n;
+	int sx, sy;
+	int xmajor;
+	int err, inc, mod;
+};
+
+int raster_clip_line(int x1, int y1, int x2, int y2, int w, int h,
+		     int skip_first, struct raster_line *l);
+
+/* One table per pixel format and drawing mode (copy or XOR).  All
+ * entries take the start of a framebuffer row and a pixel index within
+ * that row; coordinates are assumed to be already clipped.  vspan()
+ * walks n rows down from ROW, STRIDE bytes apart, and line() plots a
+ * segment prepared by raster_clip_line() through the row table ROWS.
+ * copy() moves N pixels from pixel SX of the row SRC to pixel DX of the
+ * row DST, which must not overlap; it is the same in both tables.  Formats
+ * below 8 bpp are packed with the leftmost pixel in the high bits.
+ */
+struct raster_ops {
+	int bits_per_pixel;
+	void (*pixel)(unsigned char *row, int x, unsigned color);
+	void (*hspan)(unsigned char *row, int x, int n, unsigned color);
+	void (*vspan)(unsigned char *row, int stride, int x, int n,
+		      unsigned color);
+	void (*line)(unsigned char **rows, const struct raster_line *l,
+		     unsigned color);
+	void (*copy)(unsigned char *dst, int dx, const unsigned char *src,
+		     int sx, int n);
+};
+
+const struct raster_ops *raster_select(int bits_per_pixel, int xormode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _RASTER_H */
@@ -0,0 +1,195 @@
+/*
+ * simbench.c
+ *
+ * Drawing and EPD update benchmark on the framebuffer simulator
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ *
+ * Usage: simbench [iterations]
+ *
+ * Runs a few fixed workloads through fbutils and reports the virtual
+ * panel time they take (deterministic for a given FBSIM_TIMING) along
+ * with the CPU time spent drawing.  TSLIB_FBDEVICE defaults to
+ * sim:800x600x8; pointing it at a real device works too, in which case
+ * the panel time column shows 0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fbutils.h"
+#include "damage.h"
+#include "epd.h"
+#include "fbsim.h"
+#include "pace.h"
+
+#define BLACK 0
+#define WHITE 15
+
+static double cpu_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void full_clear(int i)
+{
+	fillrect(0, 0, xres - 1, yres - 1, (i & 1) ? BLACK : WHITE);
+	flush_screen(0, 1);
+}
+
+static void stroke(int i)
+{
+	struct point pts [2];
+	__u32 marker = 0;
+	int k;
+
+	/* a pen stroke arriving one sample at a time, flushed per sample */
+	for (k = 0; k < 100; k++) {
+		pts [0].x = 100 + k * 5;
+		pts [0].y = 200 + (i * 7 + k * 3) % 200;
+		pts [1].x = pts [0].x + 5;
+		pts [1].y = 200 + (i * 7 + k * 3 + 3) % 200;
+		polyline(pts, 2, BLACK, NULL);
+		marker = flush_screen(MXC_DAMAGE_MODE_MONOCHROME, 0);
+	}
+	epd_wait(marker);
+}
+
+static void text(int i)
+{
+	int y;
+
+	for (y = 60; y < (int)yres - 16; y += 16)
+		put_string(8, y, "The quick brown fox jumps over the lazy dog",
+			   (i + y) & 15);
+	flush_screen(0, 1);
+}
+
+/* Frames offered at 15 fps; the panel cannot keep up with gray
+ * updates, so the pacer drops what would only queue up */
+static void paced(int i)
+{
+	struct pace pace;
+	int k;
+
+	pace_init(&pace, 15, 1);
+	for (k = 0; k < 30; k++) {
+		if (!pace_frame(&pace, k == 29))
+			continue;
+		fillrect(0, 0, xres - 1, yres - 1, WHITE);
+		fillrect(k * 20, 100, k * 20 + 60, 160, (i + k) & 15);
+		pace_slot(&pace);
+		pace_submitted(&pace, flush_screen(0, 0));
+	}
+	pace_finish(&pace);
+	if (i == 0)
+		printf("  paced: %lu frames, %lu dropped, %.1f fps\n",
+		       pace.frames, pace.dropped, pace_fps(&pace));
+}
+
+/* The same, completed in the hidden page and flipped to */
+static void flipped(int i)
+{
+	if (open_pages() < 0 && i == 0)
+		printf("  flipped: no second page, copying\n");
+	paced(i);
+	close_pages();
+}
+
+/* A pre-rendered screen pushed to the panel as it is, updated from
+ * where it lies or copied to the framebuffer first */
+static struct fb_buffer *frame;
+
+/* push_buffer() bypasses the damage tracking, so its updates are
+ * counted here */
+static unsigned long pushed_updates;
+static unsigned long long pushed_pixels;
+
+static void push(int mode)
+{
+	struct fb_rect r = { 0, 0, xres, yres };
+
+	epd_wait(push_buffer(frame, &r, 0, 0, mode));
+	pushed_updates++;
+	pushed_pixels += (unsigned long long)r.w * r.h;
+}
+
+static void push_alt(int i)
+{
+	(void)i;
+	push(0);
+}
+
+static void push_copy(int i)
+{
+	(void)i;
+	push(MXC_DAMAGE_MODE_COPY);
+}
+
+static void run(const char *name, void (*fn)(int), int iterations)
+{
+	const struct damage_stats *st = damage_get_stats();
+	unsigned long updates = st->updates + pushed_updates;
+	unsigned long long pixels = st->pixels + pushed_pixels;
+	uint64_t panel = fbsim_clock_ns();
+	double cpu = cpu_ms();
+	int i;
+
+	for (i = 0; i < iterations; i++)
+		fn(i);
+
+	printf("%-12s %8.1f %10.1f %8lu %12llu\n", name,
+	       cpu_ms() - cpu, (fbsim_clock_ns() - panel) / 1e6,
+	       st->updates + pushed_updates - updates,
+	       st->pixels + pushed_pixels - pixels);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 10;
+	int i;
+
+	setenv("TSLIB_FBDEVICE", "sim:800x600x8", 0);
+	if (open_framebuffer()) {
+		close_framebuffer();
+		return 1;
+	}
+	open_shadow();
+	setfont(&font_vga_8x16);
+	for (i = 0; i < 16; i++)
+		setcolor(i, i * 0x111111);
+
+	printf("workload       cpu ms   panel ms  updates       pixels\n");
+	run("full clear", full_clear, iterations);
+	run("stroke", stroke, iterations);
+	run("text", text, iterations);
+	run("paced", paced, iterations);
+	run("flipped", flipped, iterations);
+
+	frame = alloc_update_buffer(xres, yres);
+	if (frame == NULL) {
+		printf("  no room for an update buffer\n");
+	} else {
+		draw_to_buffer(frame);
+		fillrect(0, 0, xres - 1, yres - 1, WHITE);
+		for (i = 60; i < (int)yres - 16; i += 16)
+			put_string(8, i, "The quick brown fox jumps over the lazy dog",
+				   i & 15);
+		flush_screen(0, 1);
+		draw_to_buffer(NULL);
+		run("push alt", push_alt, iterations);
+		run("push copy", push_copy, iterations);
+		free_update_buffer(frame);
+	}
+
+	close_framebuffer();
+	return 0;
+}
@@ -0,0 +1,398 @@
+/*
+ * stream.c
+ *
+ * Pre-rasterized animations, played back straight from the file
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+/* frame files may outgrow 2 GB */
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "stream.h"
+#include "fbutils.h"
+
+#define HEADER_SIZE	32
+#define INDEX_SIZE	20
+
+struct stream_entry {
+	uint64_t offset;
+	uint32_t length;
+	int x, y, w, h;
+};
+
+struct stream {
+	int fd;
+	int width, height, depth;
+	uint32_t nr_frames;
+	uint64_t index;
+	uint32_t next;			/* frame stream_next() draws */
+	struct stream_entry ahead;	/* its index entry, read with the one before */
+	int have_ahead;
+	unsigned char *buf;		/* one frame's data */
+	struct stream_stats stats;
+};
+
+static void set32(unsigned char *p, uint32_t v)
+{
+	p [0] = v;
+	p [1] = v >> 8;
+	p [2] = v >> 16;
+	p [3] = v >> 24;
+}
+
+static void set16(unsigned char *p, int v)
+{
+	p [0] = v;
+	p [1] = v >> 8;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return p [0] | p [1] << 8 | p [2] << 16 | (uint32_t)p [3] << 24;
+}
+
+static int get16(const unsigned char *p)
+{
+	return p [0] | p [1] << 8;
+}
+
+static int pitch(int w, int depth)
+{
+	return (w * depth + 7) / 8;
+}
+
+/* Smallest rectangle, starting on a byte, in which CUR and PREV differ;
+ * returns 0 if they are the same */
+static int diff_rect(unsigned char **cur, unsigned char **prev, int width,
+		     int height, int depth, struct stream_entry *e)
+{
+	int x1 = width, x2 = -1, y1 = height, y2 = -1, x, y, l, r;
+
+	for (y = 0; y < height; y++) {
+		if (memcmp(cur [y], prev [y], width) == 0)
+			continue;
+		for (l = 0; cur [y][l] == prev [y][l]; l++)
+			;
+		for (r = width - 1; cur [y][r] == prev [y][r]; r--)
+			;
+		if (l < x1) x1 = l;
+		if (r > x2) x2 = r;
+		if (y1 == height) y1 = y;
+		y2 = y;
+	}
+	if (x2 < 0)
+		return 0;
+	x = x1 & ~(8 / depth - 1);
+	e->x = x;
+	e->y = y1;
+	e->w = x2 - x + 1;
+	e->h = y2 - y1 + 1;
+	return 1;
+}
+
+/* Ink (nonzero) becomes a set bit at depth 1, black at depth 4 */
+static void pack(unsigned char **rows, const struct stream_entry *e,
+		 int depth, unsigned char *out)
+{
+	int p = pitch(e->w, depth), x, y;
+	const unsigned char *row;
+
+	memset(out, 0, (size_t)p * e->h);
+	for (y = 0; y < e->h; y++, out += p) {
+		row = rows [e->y + y] + e->x;
+		for (x = 0; x < e->w; x++)
+			if (depth == 1)
+				out [x >> 3] |= (row [x] != 0) << (7 - (x & 7));
+			else
+				out [x >> 1] |= (row [x] ? 0 : 15) << ((x & 1) ? 0 : 4);
+	}
+}
+
+int stream_export(const char *path, const struct anim *a,
+		  int width, int height, int depth)
+{
+	unsigned char *raster [2] = { NULL, NULL }, **rows [2] = { NULL, NULL };
+	unsigned char *index = NULL, *data = NULL, header [HEADER_SIZE];
+	unsigned char *t, **tr;
+	struct stream_entry e;
+	uint64_t offset = HEADER_SIZE;
+	uint32_t i, s, local;
+	const struct anim_range *f;
+	const struct anim *fa;
+	char *tmp = NULL;
+	FILE *fp = NULL;
+	int k, y, ret = -1;
+
+	if (depth != 1 && depth != 4) {
+		fprintf(stderr, "%s: depth must be 1 or 4\n", path);
+		return -1;
+	}
+	for (k = 0; k < 2; k++) {
+		raster [k] = calloc(width, height);
+		rows [k] = malloc(height * sizeof(*rows [k]));
+		if (raster [k] == NULL || rows [k] == NULL)
+			goto nomem;
+		for (y = 0; y < height; y++)
+			rows [k][y] = raster [k] + (size_t)y * width;
+	}
+	index = malloc((a->nr_frames ? a->nr_frames : 1) * INDEX_SIZE);
+	data = malloc((size_t)pitch(width, depth) * height);
+	tmp = malloc(strlen(path) + 5);
+	if (index == NULL || data == NULL || tmp == NULL)
+		goto nomem;
+
+	sprintf(tmp, "%s.new", path);
+	fp = fopen(tmp, "wb");
+	if (fp == NULL) {
+		perror(tmp);
+		goto out;
+	}
+	/* the header goes in last, once the index offset is known */
+	memset(header, 0, sizeof(header));
+	if (fwrite(header, 1, HEADER_SIZE, fp) != HEADER_SIZE)
+		goto ioerr;
+
+	/* rows [1] holds the previous frame, blank for frame 0 */
+	for (i = 0; i < a->nr_frames; i++) {
+		memset(raster [0], 0, (size_t)width * height);
+		if ((fa = anim_frame(a, i, &local)) == NULL) {
+			fprintf(stderr, "%s: frame %u is not available\n", path, i);
+			fclose(fp);
+			unlink(tmp);
+			goto out;
+		}
+		f = anim_frame_range(fa, local);
+		for (s = f->first; s < f->first + f->count; s++)
+			anim_raster_stroke(rows [0], width, height,
+					   anim_stroke_points(fa, s), fa->strokes [s].count);
+
+		memset(&e, 0, sizeof(e));
+		e.offset = offset;
+		if (diff_rect(rows [0], rows [1], width, height, depth, &e)) {
+			e.length = pitch(e.w, depth) * e.h;
+			pack(rows [0], &e, depth, data);
+			if (fwrite(data, 1, e.length, fp) != e.length)
+				goto ioerr;
+			offset += e.length;
+		}
+		set32(index + i * INDEX_SIZE, e.offset);
+		set32(index + i * INDEX_SIZE + 4, e.offset >> 32);
+		set32(index + i * INDEX_SIZE + 8, e.length);
+		set16(index + i * INDEX_SIZE + 12, e.x);
+		set16(index + i * INDEX_SIZE + 14, e.y);
+		set16(index + i * INDEX_SIZE + 16, e.w);
+		set16(index + i * INDEX_SIZE + 18, e.h);
+
+		t = raster [0];
+		tr = rows [0];
+		raster [0] = raster [1];
+		rows [0] = rows [1];
+		raster [1] = t;
+		rows [1] = tr;
+	}
+	if (a->nr_frames &&
+	    fwrite(index, INDEX_SIZE, a->nr_frames, fp) != a->nr_frames)
+		goto ioerr;
+
+	memcpy(header, "PSTR", 4);
+	set32(header + 4, STREAM_VERSION);
+	set32(header + 8, width);
+	set32(header + 12, height);
+	set32(header + 16, depth);
+	set32(header + 20, a->nr_frames);
+	set32(header + 24, offset);
+	set32(header + 28, offset >> 32);
+	if (fseeko(fp, 0, SEEK_SET) < 0 ||
+	    fwrite(header, 1, HEADER_SIZE, fp) != HEADER_SIZE ||
+	    fflush(fp) != 0 || fsync(fileno(fp)) < 0)
+		goto ioerr;
+	if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+		fp = NULL;
+		perror(path);
+		unlink(tmp);
+		goto out;
+	}
+	fp = NULL;
+	ret = 0;
+	goto out;
+
+ioerr:
+	perror(tmp);
+	fclose(fp);
+	fp = NULL;
+	unlink(tmp);
+	goto out;
+nomem:
+	fprintf(stderr, "%s: out of memory\n", path);
+out:
+	for (k = 0; k < 2; k++) {
+		free(raster [k]);
+		free(rows [k]);
+	}
+	free(index);
+	free(data);
+	free(tmp);
+	return ret;
+}
+
+static int read_at(int fd, void *buf, size_t n, uint64_t offset)
+{
+	ssize_t r;
+
+	while (n) {
+		r = pread(fd, buf, n, offset);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		buf = (unsigned char *)buf + r;
+		n -= r;
+		offset += r;
+	}
+	return 0;
+}
+
+static int read_entry(struct stream *s, uint32_t frame, struct stream_entry *e)
+{
+	unsigned char p [INDEX_SIZE];
+
+	if (read_at(s->fd, p, INDEX_SIZE, s->index + (uint64_t)frame * INDEX_SIZE) < 0)
+		return -1;
+	e->offset = get32(p) | (uint64_t)get32(p + 4) << 32;
+	e->length = get32(p + 8);
+	e->x = get16(p + 12);
+	e->y = get16(p + 14);
+	e->w = get16(p + 16);
+	e->h = get16(p + 18);
+	if (e->length == 0)
+		return 0;
+	if (e->x + e->w > s->width || e->y + e->h > s->height ||
+	    e->length != (uint32_t)pitch(e->w, s->depth) * e->h)
+		return -1;
+	return 0;
+}
+
+struct stream *stream_open(const char *path)
+{
+	unsigned char header [HEADER_SIZE];
+	struct stream *s;
+
+	s = calloc(1, sizeof(*s));
+	if (s == NULL) {
+		perror("stream_open");
+		return NULL;
+	}
+	s->fd = open(path, O_RDONLY);
+	if (s->fd < 0) {
+		perror(path);
+		free(s);
+		return NULL;
+	}
+	if (read_at(s->fd, header, HEADER_SIZE, 0) < 0 ||
+	    memcmp(header, "PSTR", 4) != 0 ||
+	    get32(header + 4) != STREAM_VERSION)
+		goto bad;
+	s->width = get32(header + 8);
+	s->height = get32(header + 12);
+	s->depth = get32(header + 16);
+	s->nr_frames = get32(header + 20);
+	s->index = get32(header + 24) | (uint64_t)get32(header + 28) << 32;
+	if (s->width <= 0 || s->width > 0xffff || s->height <= 0 ||
+	    s->height > 0xffff || (s->depth != 1 && s->depth != 4))
+		goto bad;
+
+	s->stats.buffer = (size_t)pitch(s->width, s->depth) * s->height;
+	s->buf = malloc(s->stats.buffer);
+	if (s->buf == NULL) {
+		perror("stream_open");
+		close(s->fd);
+		free(s);
+		return NULL;
+	}
+	/* the whole index is small; the kernel may as well fetch it now */
+	posix_fadvise(s->fd, s->index, (off_t)s->nr_frames * INDEX_SIZE,
+		      POSIX_FADV_WILLNEED);
+	return s;
+
+bad:
+	fprintf(stderr, "%s: not a stream file\n", path);
+	close(s->fd);
+	free(s);
+	return NULL;
+}
+
+void stream_close(struct stream *s)
+{
+	if (s == NULL)
+		return;
+	close(s->fd);
+	free(s->buf);
+	free(s);
+}
+
+uint32_t stream_frames(const struct stream *s)
+{
+	return s->nr_frames;
+}
+
+int stream_depth(const struct stream *s)
+{
+	return s->depth;
+}
+
+int stream_next(struct stream *s, const unsigned *palette)
+{
+	struct stream_entry e;
+
+	if (s->next >= s->nr_frames)
+		return 0;
+	if (s->have_ahead)
+		e = s->ahead;
+	else if (read_entry(s, s->next, &e) < 0)
+		goto corrupt;
+
+	if (e.length) {
+		if (read_at(s->fd, s->buf, e.length, e.offset) < 0)
+			goto corrupt;
+		/* read once: don't let a long animation fill the page cache */
+		posix_fadvise(s->fd, e.offset, e.length, POSIX_FADV_DONTNEED);
+	}
+
+	/* while this frame is drawn and sent, the kernel reads the next */
+	s->have_ahead = 0;
+	if (s->next + 1 < s->nr_frames && read_entry(s, s->next + 1, &s->ahead) == 0) {
+		s->have_ahead = 1;
+		if (s->ahead.length)
+			posix_fadvise(s->fd, s->ahead.offset, s->ahead.length,
+				      POSIX_FADV_WILLNEED);
+	}
+
+	if (e.length)
+		put_bitmap(e.x, e.y, e.w, e.h, s->buf, pitch(e.w, s->depth),
+			   s->depth, palette);
+	s->next++;
+	s->stats.frames++;
+	s->stats.bytes += e.length;
+	return 1;
+
+corrupt:
+	fprintf(stderr, "stream: frame %u is corrupt\n", s->next);
+	return -1;
+}
+
+const struct stream_stats *stream_get_stats(const struct stream *s)
+{
+	return &s->stats;
+}
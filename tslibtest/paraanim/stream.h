@@ -0,0 +1,77 @@
+/*
+ * stream.h
+ *
+ * Pre-rasterized animations, played back straight from the file
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "anim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* File layout, all numbers little-endian:
+ *
+ *   header	"PSTR", version, width, height, depth (1 or 4 bits per
+ *		pixel), number of frames, offset of the index (8 bytes)
+ *   frames	per frame, the rectangle in which it differs from the
+ *		frame before (frame 0: from a blank page), packed row
+ *		by row, most significant bits first
+ *   index	per frame: offset (8 bytes) and length (4 bytes) of its
+ *		data, the rectangle x, y, w, h (2 bytes each)
+ *
+ * At depth 1 a set bit is ink; at depth 4 pixels are gray levels from
+ * 0 (black ink) to 15 (white paper).  Rectangles start on a byte.
+ */
+#define STREAM_VERSION 1
+
+struct stream;
+
+struct stream_stats {
+	unsigned long frames;		/* frames drawn */
+	unsigned long long bytes;	/* frame data read */
+	size_t buffer;			/* size of the frame buffer */
+};
+
+/* Rasterize the frames of A at WIDTH x HEIGHT and DEPTH bits per pixel
+ * into PATH, replacing it only once the new file is complete.
+ * Returns -1 with a message on stderr on failure.
+ */
+int stream_export(const char *path, const struct anim *a,
+		  int width, int height, int depth);
+
+/* Returns NULL (with a message on stderr) if PATH is missing or not a
+ * stream file */
+struct stream *stream_open(const char *path);
+void stream_close(struct stream *s);
+
+uint32_t stream_frames(const struct stream *s);
+int stream_depth(const struct stream *s);
+
+/* Draw the changed rectangle of the next frame, mapping pixel values
+ * to color indices through PALETTE (2 or 16 entries).  Frames build on
+ * each other and must all be drawn, in order, onto a blank page; only
+ * the ones that are shown need a flush.  The frame after it is read
+ * ahead meanwhile.  Returns 0 at the end of the file and -1 on errors.
+ */
+int stream_next(struct stream *s, const unsigned *palette);
+
+const struct stream_stats *stream_get_stats(const struct stream *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _STREAM_H */
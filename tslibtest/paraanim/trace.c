@@ -0,0 +1,128 @@
+/*
+ * trace.c
+ *
+ * Lock-free trace ring for EPD updates
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "trace.h"
+#include "fbsim.h"
+
+/* Update markers are handed out by a monotonic counter, so each update
+ * owns the slot marker % TRACE_SIZE and writers never contend for one.
+ * A slot is published by storing its marker last; readers take a copy
+ * and drop it if the marker changed underneath them.
+ */
+static struct trace_rec ring [TRACE_SIZE];
+static volatile uint32_t newest;
+static uint32_t drained;
+static unsigned long lost;
+
+/* Under the simulator updates run on its virtual clock */
+uint64_t trace_now(void)
+{
+	struct timespec ts;
+
+	if (fbsim_active())
+		return fbsim_clock_ns();
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace_submit(uint32_t marker, int x, int y, int w, int h,
+		  int mode, int waveform, uint64_t submit_ns)
+{
+	struct trace_rec *r = &ring [marker % TRACE_SIZE];
+
+	r->marker = 0;
+	__sync_synchronize();
+	r->x = x;
+	r->y = y;
+	r->w = w;
+	r->h = h;
+	r->mode = mode;
+	r->waveform = waveform;
+	r->submit_ns = submit_ns;
+	r->complete_ns = 0;
+	__sync_synchronize();
+	r->marker = marker;
+	newest = marker;
+}
+
+void trace_complete(uint32_t marker)
+{
+	struct trace_rec *r = &ring [marker % TRACE_SIZE];
+	uint64_t now = trace_now();
+
+	if (r->marker == marker) {
+		r->complete_ns = now;
+		__sync_synchronize();
+	}
+}
+
+int trace_drain(const char *path, int csv)
+{
+	struct trace_header hdr = { TRACE_MAGIC, TRACE_VERSION, sizeof(struct trace_rec) };
+	struct trace_rec rec;
+	volatile uint32_t *mark;
+	uint32_t m, first, end = newest;
+	FILE *f;
+	int n = 0;
+
+	f = fopen(path, "a");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	if (ftell(f) == 0) {
+		if (csv)
+			fprintf(f, "marker,x,y,w,h,mode,waveform,submit_ns,complete_ns\n");
+		else
+			fwrite(&hdr, sizeof(hdr), 1, f);
+	}
+
+	for (m = drained + 1; (int32_t)(end - m) >= 0; m++) {
+		if (m == 0)
+			continue;
+		/* trace_submit() may rewrite the slot while it is copied */
+		mark = &ring [m % TRACE_SIZE].marker;
+		first = *mark;
+		__sync_synchronize();
+		rec = ring [m % TRACE_SIZE];
+		__sync_synchronize();
+		if (first != m || *mark != m) {
+			lost++;
+			continue;
+		}
+		if (rec.complete_ns == 0)
+			break;
+
+		if (csv)
+			fprintf(f, "%u,%u,%u,%u,%u,%u,%u,%llu,%llu\n",
+				rec.marker, rec.x, rec.y, rec.w, rec.h,
+				rec.mode, rec.waveform,
+				(unsigned long long)rec.submit_ns,
+				(unsigned long long)rec.complete_ns);
+		else
+			fwrite(&rec, sizeof(rec), 1, f);
+		n++;
+	}
+	drained = m - 1;
+
+	fclose(f);
+	return n;
+}
+
+unsigned long trace_lost(void)
+{
+	return lost;
+}
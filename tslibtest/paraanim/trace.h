@@ -0,0 +1,60 @@
+/*
+ * trace.h
+ *
+ * Lock-free trace ring for EPD updates
+ *
+ * Copyright (C) 2012 yoshizow
+ *
+ * This file is placed under the GPL.  Please see the
+ * file COPYING for details.
+ *
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of updates kept; older ones are overwritten */
+#define TRACE_SIZE 1024
+
+#define TRACE_MAGIC   0x54445045	/* "EPDT" */
+#define TRACE_VERSION 1
+
+/* A binary trace file is a trace_header followed by trace_rec records
+ * up to the end of the file */
+struct trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rec_size;
+};
+
+struct trace_rec {
+	uint32_t marker;
+	uint16_t x, y, w, h;
+	uint16_t mode;			/* MXC_DAMAGE_MODE_* flags */
+	uint16_t waveform;		/* waveform mode sent to the driver */
+	uint64_t submit_ns;		/* CLOCK_MONOTONIC */
+	uint64_t complete_ns;		/* 0 while in flight */
+};
+
+uint64_t trace_now(void);
+void trace_submit(uint32_t marker, int x, int y, int w, int h,
+		  int mode, int waveform, uint64_t submit_ns);
+void trace_complete(uint32_t marker);
+
+/* Append all completed records not drained yet to PATH, as CSV when CSV
+ * is set.  Returns the number of records written or -1 on error.
+ */
+int trace_drain(const char *path, int csv);
+unsigned long trace_lost(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TRACE_H */
@@ -167,28 +167,40 @@ void close_framebuffer(void)
         free (line_addr);
 }
 
-void put_cross(int x, int y, unsigned colidx)
-{
-	line (x - 10, y, x - 2, y, colidx);
-	line (x + 2, y, x + 10, y, colidx);
-	line (x, y - 10, x, y - 2, colidx);
-	line (x, y + 2, x, y + 10, colidx);
-
+/* The crosshair as x1, y1, x2, y2 relative to its centre and a color
+ * offset; segments are horizontal, vertical or at 45 degrees */
+static const signed char cross_segs [][5] = {
+	{ -10,  0,  -2,   0, 0 },
+	{   2,  0,  10,   0, 0 },
+	{   0, -10,  0,  -2, 0 },
+	{   0,  2,   0,  10, 0 },
 #if 1
-	line (x - 6, y - 9, x - 9, y - 9, colidx + 1);
-	line (x - 9, y - 8, x - 9, y - 6, colidx + 1);
-	line (x - 9, y + 6, x - 9, y + 9, colidx + 1);
-	line (x - 8, y + 9, x - 6, y + 9, colidx + 1);
-	line (x + 6, y + 9, x + 9, y + 9, colidx + 1);
-	line (x + 9, y + 8, x + 9, y + 6, colidx + 1);
-	line (x + 9, y - 6, x + 9, y - 9, colidx + 1);
-	line (x + 8, y - 9, x + 6, y - 9, colidx + 1);
+	{  -6, -9,  -9,  -9, 1 },
+	{  -9, -8,  -9,  -6, 1 },
+	{  -9,  6,  -9,   9, 1 },
+	{  -8,  9,  -6,   9, 1 },
+	{   6,  9,   9,   9, 1 },
+	{   9,  8,   9,   6, 1 },
+	{   9, -6,   9,  -9, 1 },
+	{   8, -9,   6,  -9, 1 },
 #else
-	line (x - 7, y - 7, x - 4, y - 4, colidx + 1);
-	line (x - 7, y + 7, x - 4, y + 4, colidx + 1);
-	line (x + 4, y - 4, x + 7, y - 7, colidx + 1);
-	line (x + 4, y + 4, x + 7, y + 7, colidx + 1);
+	{  -7, -7,  -4,  -4, 1 },
+	{  -7,  7,  -4,   4, 1 },
+	{   4, -4,   7,  -7, 1 },
+	{   4,  4,   7,   7, 1 },
 #endif
+};
+#define NR_CROSS_SEGS (sizeof (cross_segs) / sizeof (cross_segs [0]))
+
+void put_cross(int x, int y, unsigned colidx)
+{
+	const signed char *s;
+	unsigned i;
+
+	for (i = 0; i < NR_CROSS_SEGS; i++) {
+		s = cross_segs [i];
+		line (x + s [0], y + s [1], x + s [2], y + s [3], colidx + s [4]);
+	}
 }
 
 void put_char(int x, int y, int c, int colidx)
@@ -391,3 +403,172 @@ void fillrect (int x1, int y1, int x2, int y2, unsigned colidx)
 		}
 	}
 }
+
+struct sprite {
+	int w, h, hot_x, hot_y;
+	unsigned *image;		/* pixel values, w * h */
+	unsigned char *mask;		/* nonzero where the sprite is opaque */
+	unsigned char *save;		/* pixels under it, w * h * bytes_per_pixel */
+	int visible;
+	int sx, sy;			/* top left corner on screen */
+	int x1, y1, x2, y2;		/* the on-screen part that was saved */
+};
+
+struct sprite *sprite_new (int w, int h, int hot_x, int hot_y)
+{
+	struct sprite *spr;
+
+	spr = calloc (1, sizeof (*spr));
+	if (spr == NULL)
+		return NULL;
+	spr->w = w;
+	spr->h = h;
+	spr->hot_x = hot_x;
+	spr->hot_y = hot_y;
+	spr->image = calloc (w * h, sizeof (*spr->image));
+	spr->mask = calloc (w * h, 1);
+	spr->save = malloc (w * h * bytes_per_pixel);
+	if (spr->image == NULL || spr->mask == NULL || spr->save == NULL) {
+		sprite_free (spr);
+		return NULL;
+	}
+	return spr;
+}
+
+void sprite_free (struct sprite *spr)
+{
+	if (spr == NULL)
+		return;
+	free (spr->image);
+	free (spr->mask);
+	free (spr->save);
+	free (spr);
+}
+
+void sprite_pixel (struct sprite *spr, int x, int y, unsigned colidx)
+{
+	if (x < 0 || x >= spr->w || y < 0 || y >= spr->h)
+		return;
+	spr->image [y * spr->w + x] = colormap [colidx & ~XORMODE];
+	spr->mask [y * spr->w + x] = 1;
+}
+
+/* The crosshair of put_cross() as a sprite, hot spot in the middle */
+struct sprite *sprite_cross (unsigned colidx)
+{
+	struct sprite *spr;
+	const signed char *s;
+	int x, y, dx, dy, n;
+	unsigned i;
+
+	spr = sprite_new (21, 21, 10, 10);
+	if (spr == NULL)
+		return NULL;
+	for (i = 0; i < NR_CROSS_SEGS; i++) {
+		s = cross_segs [i];
+		dx = (s [2] > s [0]) - (s [2] < s [0]);
+		dy = (s [3] > s [1]) - (s [3] < s [1]);
+		n = abs (s [2] - s [0]) > abs (s [3] - s [1]) ?
+			abs (s [2] - s [0]) : abs (s [3] - s [1]);
+		for (x = s [0], y = s [1]; n >= 0; n--, x += dx, y += dy)
+			sprite_pixel (spr, x + 10, y + 10, colidx + s [4]);
+	}
+	return spr;
+}
+
+static void sprite_restore (struct sprite *spr)
+{
+	int y, n = (spr->x2 - spr->x1 + 1) * bytes_per_pixel;
+
+	if (spr->x1 > spr->x2 || spr->y1 > spr->y2)
+		return;
+	for (y = spr->y1; y <= spr->y2; y++)
+		memcpy (line_addr [y] + spr->x1 * bytes_per_pixel,
+			spr->save + ((y - spr->sy) * spr->w + spr->x1 - spr->sx) *
+			bytes_per_pixel, n);
+}
+
+static void sprite_show (struct sprite *spr)
+{
+	union multiptr loc;
+	int x, y, i, n;
+
+	spr->x1 = spr->sx < 0 ? 0 : spr->sx;
+	spr->y1 = spr->sy < 0 ? 0 : spr->sy;
+	spr->x2 = spr->sx + spr->w - 1;
+	spr->y2 = spr->sy + spr->h - 1;
+	if (spr->x2 >= (int)xres) spr->x2 = xres - 1;
+	if (spr->y2 >= (int)yres) spr->y2 = yres - 1;
+
+	/* entirely off the screen: nothing to save or draw */
+	spr->visible = 1;
+	if (spr->x1 > spr->x2 || spr->y1 > spr->y2)
+		return;
+
+	n = (spr->x2 - spr->x1 + 1) * bytes_per_pixel;
+	for (y = spr->y1; y <= spr->y2; y++) {
+		i = (y - spr->sy) * spr->w + spr->x1 - spr->sx;
+		memcpy (spr->save + i * bytes_per_pixel,
+			line_addr [y] + spr->x1 * bytes_per_pixel, n);
+		loc.p8 = line_addr [y] + spr->x1 * bytes_per_pixel;
+		for (x = spr->x1; x <= spr->x2; x++, i++) {
+			if (spr->mask [i])
+				__setpixel (loc, 0, spr->image [i]);
+			loc.p8 += bytes_per_pixel;
+		}
+	}
+}
+
+static void box_union (int *box, int x1, int y1, int x2, int y2)
+{
+	if (x1 > x2 || y1 > y2)
+		return;
+	if (box [0] > box [2]) {
+		box [0] = x1; box [1] = y1; box [2] = x2; box [3] = y2;
+		return;
+	}
+	if (x1 < box [0]) box [0] = x1;
+	if (y1 < box [1]) box [1] = y1;
+	if (x2 > box [2]) box [2] = x2;
+	if (y2 > box [3]) box [3] = y2;
+}
+
+int sprite_move (struct sprite *spr, int x, int y, int *box)
+{
+	int b [4] = { 0, 0, -1, -1 };
+
+	x -= spr->hot_x;
+	y -= spr->hot_y;
+	if (spr->visible && spr->sx == x && spr->sy == y)
+		return 0;
+
+	if (spr->visible) {
+		sprite_restore (spr);
+		box_union (b, spr->x1, spr->y1, spr->x2, spr->y2);
+	}
+	spr->sx = x;
+	spr->sy = y;
+	sprite_show (spr);
+	box_union (b, spr->x1, spr->y1, spr->x2, spr->y2);
+
+	if (b [0] > b [2])
+		return 0;
+	if (box != NULL)
+		memcpy (box, b, sizeof (b));
+	return 1;
+}
+
+int sprite_hide (struct sprite *spr, int *box)
+{
+	if (!spr->visible)
+		return 0;
+	sprite_restore (spr);
+	spr->visible = 0;
+	if (spr->x1 > spr->x2 || spr->y1 > spr->y2)
+		return 0;
+	if (box != NULL) {
+		box [0] = spr->x1; box [1] = spr->y1;
+		box [2] = spr->x2; box [3] = spr->y2;
+	}
+	return 1;
+}
@@ -34,4 +34,22 @@ void line (int x1, int y1, int x2, int y2, unsigned colidx);
 void rect (int x1, int y1, int x2, int y2, unsigned colidx);
 void fillrect (int x1, int y1, int x2, int y2, unsigned colidx);
 
+/* A sprite is a masked bitmap kept on top of the framebuffer with a
+ * save-under buffer: moving it restores the pixels it covered, saves
+ * the ones at the new place and blits itself there, touching only its
+ * own rectangle.  Anything drawn over a visible sprite must hide it
+ * first or the save-under goes stale.
+ */
+struct sprite;
+
+struct sprite *sprite_new (int w, int h, int hot_x, int hot_y);
+struct sprite *sprite_cross (unsigned colidx);
+void sprite_free (struct sprite *spr);
+void sprite_pixel (struct sprite *spr, int x, int y, unsigned colidx);
+/* Each of these stores the screen area that changed in *BOX as
+ * x1, y1, x2, y2 (inclusive) and returns 1, or returns 0 if nothing
+ * changed; BOX may be NULL */
+int sprite_move (struct sprite *spr, int x, int y, int *box);
+int sprite_hide (struct sprite *spr, int *box);
+
 #endif /* _FBUTILS_H */
@@ -14,7 +14,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <signal.h>
+#include <poll.h>
 #include <sys/fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -47,8 +49,13 @@ static int button_palette [6] =
 };
 
 #define NR_BUTTONS 3
+/* Samples taken from tslib per read */
+#define MAX_SAMPLES 32
 static struct ts_button buttons [NR_BUTTONS];
 
+static struct sprite *cursor;
+static void hide_cursor (void);
+
 static void sig(int sig)
 {
 	close_framebuffer();
@@ -61,6 +68,7 @@ static void sig(int sig)
 static void button_draw (struct ts_button *button)
 {
 	int s = (button->flags & BUTTON_ACTIVE) ? 3 : 0;
+	hide_cursor ();
 	rect (button->x, button->y, button->x + button->w - 1,
 	      button->y + button->h - 1, button_palette [s]);
 	fillrect (button->x + 1, button->y + 1,
@@ -102,6 +110,7 @@ static void refresh_screen ()
 {
 	int i;
 
+	hide_cursor ();
 	fillrect (0, 0, xres - 1, yres - 1, 0);
 	put_string_center (xres/2, yres/4,   "TSLIB test program", 1);
 	put_string_center (xres/2, yres/4+20,"Touch screen to move crosshair", 2);
@@ -136,7 +145,11 @@ mxc_damage(int x, int y, int w, int h){
     param.flags = EPDC_FLAG_FORCE_MONOCHROME;
     /* alt_buffer_data */
     r = ioctl(mxcfb, MXCFB_SEND_UPDATE, &param);
+    if (r < 0)
+        perror("MXCFB_SEND_UPDATE");
+#ifdef DEBUG
     printf("send update = %d\n",r);
+#endif
 #if 0
     r = ioctl(mxcfb, MXCFB_WAIT_FOR_UPDATE_COMPLETE, &MARKER);
     printf("wait = %d\n",r);
@@ -157,6 +170,57 @@ static void reflect_screen (int x1, int y1, int x2, int y2)
     mxc_damage(x1, y1, x2 - x1 + 1, y2 - y1 + 1);
 }
 
+/* Screen area changed since the last update: cursor moves and ink are
+ * collected here and sent as one update per batch of samples */
+static int dirty [4] = { 0, 0, -1, -1 };
+
+static void add_damage (int x1, int y1, int x2, int y2)
+{
+	int t;
+
+	if (x1 > x2) {
+		t = x1; x1 = x2; x2 = t;
+	}
+	if (y1 > y2) {
+		t = y1; y1 = y2; y2 = t;
+	}
+	if (dirty [0] > dirty [2]) {
+		dirty [0] = x1; dirty [1] = y1; dirty [2] = x2; dirty [3] = y2;
+		return;
+	}
+	if (x1 < dirty [0]) dirty [0] = x1;
+	if (y1 < dirty [1]) dirty [1] = y1;
+	if (x2 > dirty [2]) dirty [2] = x2;
+	if (y2 > dirty [3]) dirty [3] = y2;
+}
+
+static void flush_damage (void)
+{
+	if (dirty [0] <= dirty [2]) {
+		reflect_screen (dirty [0], dirty [1], dirty [2], dirty [3]);
+		dirty [2] = -1;
+	}
+}
+
+/* Take the cursor off the screen before drawing over it */
+static void hide_cursor (void)
+{
+	int box [4];
+
+	if (cursor != NULL && sprite_hide (cursor, box))
+		add_damage (box [0], box [1], box [2], box [3]);
+}
+
+/* Put the cursor at X, Y: one restore and one blit covering both the
+ * old and the new position, nothing at all if it is already there */
+static void move_cursor (int x, int y)
+{
+	int box [4];
+
+	if (cursor != NULL && sprite_move (cursor, x, y, box))
+		add_damage (box [0], box [1], box [2], box [3]);
+}
+
 int main()
 {
 	struct tsdev *ts;
@@ -171,11 +235,12 @@ int main()
 	signal(SIGINT, sig);
 	signal(SIGTERM, sig);
 
+	/* Non-blocking: ts_read() returns whatever samples are queued */
 	if( (tsdevice = getenv("TSLIB_TSDEVICE")) != NULL ) {
-		ts = ts_open(tsdevice,0);
+		ts = ts_open(tsdevice,1);
 	} else {
-		if (!(ts = ts_open("/dev/input/event1", 0)))
-			ts = ts_open("/dev/touchscreen/ucb1x00", 0);
+		if (!(ts = ts_open("/dev/input/event1", 1)))
+			ts = ts_open("/dev/touchscreen/ucb1x00", 1);
 	}
 
 	if (!ts) {
@@ -211,61 +276,77 @@ int main()
 	buttons [1].text = "Draw";
 	buttons [2].text = "Quit";
 
+	cursor = sprite_cross (2);
+
 	refresh_screen ();
 
 	while (1) {
-		struct ts_sample samp;
-		int ret;
+		struct ts_sample samps [MAX_SAMPLES];
+		struct pollfd pfd;
+		int ret, n;
 
-		/* Show the cross */
+		/* The cross stays up while we wait and only moves when the
+		 * position changed */
 		if ((mode & 15) != 1)
-			put_cross(x, y, 2 | XORMODE);
-
-		ret = ts_read(ts, &samp, 1);
+			move_cursor (x, y);
+		else
+			hide_cursor ();
+		flush_damage ();
+
+		pfd.fd = ts_fd(ts);
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			perror("poll");
+			close_framebuffer();
+			exit(1);
+		}
 
-		/* Hide it */
-		if ((mode & 15) != 1)
-			put_cross(x, y, 2 | XORMODE);
+		ret = ts_read(ts, samps, MAX_SAMPLES);
 
-		if (ret < 0) {
+		if (ret < 0 && errno != EAGAIN) {
 			perror("ts_read");
 			close_framebuffer();
 			exit(1);
 		}
 
-		if (ret != 1)
-			continue;
-
-		for (i = 0; i < NR_BUTTONS; i++)
-			if (button_handle (&buttons [i], &samp))
-				switch (i) {
-				case 0:
-					mode = 0;
-					refresh_screen ();
-					break;
-				case 1:
-					mode = 1;
-					refresh_screen ();
-					break;
-				case 2:
-					quit_pressed = 1;
-				}
+		/* Everything queued up is handled before the next update */
+		for (n = 0; n < ret; n++) {
+			struct ts_sample *samp = &samps [n];
+
+			for (i = 0; i < NR_BUTTONS; i++)
+				if (button_handle (&buttons [i], samp))
+					switch (i) {
+					case 0:
+						mode = 0;
+						refresh_screen ();
+						break;
+					case 1:
+						mode = 1;
+						refresh_screen ();
+						break;
+					case 2:
+						quit_pressed = 1;
+					}
+
+#ifdef DEBUG
+			printf("%ld.%06ld: %6d %6d %6d\n", samp->tv.tv_sec, samp->tv.tv_usec,
+				samp->x, samp->y, samp->pressure);
+#endif
 
-		printf("%ld.%06ld: %6d %6d %6d\n", samp.tv.tv_sec, samp.tv.tv_usec,
-			samp.x, samp.y, samp.pressure);
-
-		if (samp.pressure > 0) {
-			if (mode == 0x80000001) {
-				line (x, y, samp.x, samp.y, 2);
-                                reflect_screen (x, y, samp.x, samp.y);
-                        }
-			x = samp.x;
-			y = samp.y;
-			mode |= 0x80000000;
-		} else
-			mode &= ~0x80000000;
+			if (samp->pressure > 0) {
+				if (mode == 0x80000001) {
+					line (x, y, samp->x, samp->y, 2);
+					add_damage (x, y, samp->x, samp->y);
+				}
+				x = samp->x;
+				y = samp->y;
+				mode |= 0x80000000;
+			} else
+				mode &= ~0x80000000;
+		}
 		if (quit_pressed)
 			break;
 	}
+	sprite_free (cursor);
 	close_framebuffer();
 }